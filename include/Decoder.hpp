@@ -0,0 +1,62 @@
+#ifndef DECODER_HPP
+#define DECODER_HPP
+
+#include "Program.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace bs {
+
+	//Dense opcodes for the tokens, so the switches over them compile to jump tables
+	enum Opcode : uint8_t {
+		OP_SHIFT_RIGHT,
+		OP_SHIFT_LEFT,
+		OP_INCREMENT,
+		OP_DECREMENT,
+		OP_START_LOOP,
+		OP_END_LOOP,
+		OP_INPUT,
+		OP_OUTPUT,
+		OP_PRINT,
+		OP_CLEAR,
+		OP_SET,
+		OP_MULTIPLY,
+		OP_SCAN_RIGHT,
+		OP_SCAN_LEFT,
+		OP_UNMATCHED, //A bracket without a match, its data is the bracket
+		OP_HALT,
+		OP_COUNT
+	};
+
+	/**
+	 * A token packed into 8 bytes, without the padding a Token has. The offset only gets
+	 * 24 bits, the decoder moves the pointer over and back for the rare token that needs more.
+	 */
+	struct Instruction {
+		Opcode op : 8;
+		int offset : 24;   //Cell relative to the data pointer, or the length of a print
+		uint32_t data;     //Amount, the index of the matching bracket's instruction for loops, or where a print starts in the constants
+	};
+
+	static_assert(sizeof(Instruction) == 8, "Instructions should be packed into 8 bytes");
+
+	/**
+	 * Decodes the tokens of a processed program into instructions, dropping anything that isn't
+	 * an instruction and pointing the loops at instruction indices. A halt instruction goes at the
+	 * end so the engines never have to check the length.
+	 *
+	 * @param unmatched Whether brackets without a match become OP_UNMATCHED, so they're only an error once they're
+	 * reached like they are for the BasicInterpreter, instead of failing the whole program
+	 * @param origin Set to the index of the token each instruction came from, with the token count for the halt
+	 * @param error Set to what went wrong, if anything did
+	 *
+	 * @return Whether the program could be decoded.
+	 */
+	bool decode(const Program &program, std::vector<Instruction> &code, std::vector<std::size_t> &origin, std::string &error, bool unmatched = false);
+
+}
+
+#endif //DECODER_HPP
@@ -0,0 +1,65 @@
+#ifndef INPUT_HPP
+#define INPUT_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace bs {
+
+	//What a cell gets set to when input is read after the end of it
+	enum EOF_POLICY {
+		EOF_ZERO,      //The cell is set to 0
+		EOF_MINUS_ONE, //The cell is set to 255
+		EOF_UNCHANGED  //The cell keeps its value
+	};
+
+	/**
+	 * Reads the standard input into a buffer, so most bytes are taken straight from memory.
+	 * Line mode reads a line at a time without the newline and skips empty lines, like typing into the REPL.
+	 * Raw mode reads everything as it is, in big reads, or maps the whole input when it's a file.
+	 */
+	class InputReader {
+	public:
+
+		static constexpr std::size_t BUFFER_SIZE = 1 << 16; //How much raw mode reads at a time
+
+		InputReader();
+		~InputReader();
+
+		InputReader(const InputReader&) = delete;
+		InputReader& operator=(const InputReader&) = delete;
+
+		//Has to be set before anything is read
+		inline void setRaw(bool raw) { m_raw = raw; }
+		inline bool isRaw() const { return m_raw; }
+
+		//Takes the next byte, false if the input ended
+		inline bool next(unsigned char &byte) {
+			if(m_next == m_end && !refill())
+				return false;
+
+			byte = *m_next++;
+			return true;
+		}
+
+		//The unread part of the buffer, compiled code takes bytes from here itself and only calls in when it's empty
+		const unsigned char *m_next = nullptr;
+		const unsigned char *m_end = nullptr;
+
+	private:
+
+		bool m_raw = false;
+		bool m_ended = false;
+		std::string m_line;
+		std::vector<unsigned char> m_buffer;
+		void *m_mapped = nullptr; //The input file, when it was mapped
+		std::size_t m_mappedSize = 0;
+
+		bool refill();
+		bool mapInput();
+	};
+
+}
+
+#endif //INPUT_HPP
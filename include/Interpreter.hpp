@@ -2,9 +2,13 @@
 #define INTERPRETER_HPP
 
 #include "Program.hpp"
+#include "Decoder.hpp"
+#include "ProgramCache.hpp"
 #include "Memory.hpp"
+#include "Input.hpp"
+#include "Output.hpp"
 
-#include <deque>
+#include <cstdint>
 #include <iostream>
 
 
@@ -13,7 +17,10 @@ namespace bs {
     class Interpreter {
     public:
 
-        Interpreter(std::ostream &stream = std::cout, bool numInput = false, std::size_t memSize = 30000);
+		static constexpr std::size_t PRE_RUN_BUDGET = 10000000; //Default for setPreRunBudget()
+		static constexpr std::size_t OUTPUT_BUFFER_SIZE = 4096; //Default for setOutputBufferSize()
+
+        Interpreter(std::ostream &stream = std::cout, bool numInput = false, std::size_t memSize = 30000, TAPE_KIND tape = TAPE_FIXED);
 		virtual ~Interpreter();
 
         virtual bool loadProgram(const char *program, bool process = true, bool resetDataPtr = true, unsigned int optimization = 2) = 0;
@@ -26,27 +33,52 @@ namespace bs {
 		inline std::size_t getInstPtr() { return m_instPtr; }
 		inline std::size_t getDataPtr() { return m_dataPtr; }
 		inline std::string getError()   { return m_error; }
+		inline const std::vector<PassStats>& getPassStats() { return m_emitter.getPassStats(); }
+
+		//How many instructions loadProgram() can run ahead of time, 0 turns it off
+		inline void setPreRunBudget(std::size_t budget) { m_preRunBudget = budget; }
+		//How much output is held before it's written to the stream, 0 writes every byte
+		inline void setOutputBufferSize(std::size_t size) { m_output.setBufferSize(size); }
+		//Writes output straight to the file descriptor instead of the stream, -1 goes back to the stream
+		inline void setOutputFile(int file) { m_output.setFile(file); }
+		//Where optimized and compiled programs are kept between runs, an empty string turns it off
+		inline void setCacheDir(const std::string &directory) { m_cache.setDirectory(directory); }
+		//Whether input is read as raw bytes instead of a line at a time, has to be set before any input is read
+		inline void setRawInput(bool raw) { m_input.setRaw(raw); }
+		//What input sets a cell to once there isn't any more
+		inline void setEOFPolicy(EOF_POLICY policy) { m_eofPolicy = policy; }
 
     protected:
 
-        std::deque<char> m_inBuffer;
-        std::ostream &m_stream;
+        InputReader m_input;
+        OutputWriter m_output;
 		IREmitter m_emitter;
+		ProgramCache m_cache;
 		Tape m_memory;
 		Program m_program;
 		std::size_t m_instPtr;
 		std::size_t m_dataPtr;
 		std::string m_error;
 		bool m_numInput;
-
-		char getChar();
+		std::string m_preOutput; //Output from preRun() that hasn't been written yet
+		std::size_t m_preRunBudget;
+		EOF_POLICY m_eofPolicy = EOF_UNCHANGED;
+
+		unsigned char getChar(unsigned char current);
+		bool processProgram(unsigned int optimization, bool resetDataPtr);
+		inline void putChar(char c) { m_output.put(c); }
+		inline void putString(const char *string, std::size_t length) { m_output.write(string, length); }
+		inline void flushOutput() { m_output.flush(); }
+
+		void preRun();
+		void flushPreRun();
     };
 
 
     class BasicInterpreter : public Interpreter {
 	public:
 
-		BasicInterpreter(std::ostream &stream = std::cout, bool numInput = false, std::size_t memSize = 30000);
+		BasicInterpreter(std::ostream &stream = std::cout, bool numInput = false, std::size_t memSize = 30000, TAPE_KIND tape = TAPE_FIXED);
 		~BasicInterpreter();
 
 		bool loadProgram(const char *program, bool process = true, bool resetDataPtr = true, unsigned int optimization = 2) override;
@@ -55,7 +87,11 @@ namespace bs {
 
 	private:
 		
-		std::deque<std::size_t> m_jumpTable;
+		std::vector<uint32_t> m_brackets; //Position of the matching bracket for each bracket in the unprocessed source
+		std::vector<uint32_t> m_next; //Position of the next command from each position in the unprocessed source
+		std::vector<Instruction> m_code; //The processed program, decoded for stepProcessed()
+		std::vector<std::size_t> m_origin; //Token index of each instruction in m_code
+		std::size_t m_pc = 0; //Index into m_code, m_instPtr follows it
 		bool stepProcessed();
 		bool stepUnprocessed();
 	};
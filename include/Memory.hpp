@@ -1,9 +1,14 @@
 #ifndef MEMORY_HPP
 #define MEMORY_HPP
 
+#include "config.hpp"
+
 #include <cstddef>
+#include <cstdint>
 #include <cstring>
 #include <iostream>
+#include <memory>
+#include <vector>
 
 namespace bs {
 
@@ -15,15 +20,45 @@ namespace bs {
 		BASE_BIN = 2
 	};
 
+	enum TAPE_KIND {
+		TAPE_FIXED,   //The size it was made with, starting from the first cell
+		TAPE_GROWABLE, //GROWABLE_SIZE cells reserved up front, starting from the middle, only the pages that are touched use memory
+		TAPE_SPARSE    //SPARSE_SIZE cells starting from the middle, kept in pages found through a table instead of one allocation
+	};
+
 	/** Memory used in Brainf, it is a array of bytes */
 	struct Tape {
-		Tape(std::size_t size = 0);
-		~Tape() { delete[] m_cells; }
+		//Inaccessible bytes on both sides of the cells, when USE_GUARD_PAGES is defined
+		static constexpr std::size_t GUARD_SIZE = 1 << 24;
+		//Cells reserved for a growable tape, half on each side of where it starts
+		static constexpr std::size_t GROWABLE_SIZE = std::size_t(1) << 30;
+		//Cells in each page of a sparse tape, and pages in each table the directory points to
+		static constexpr std::size_t PAGE_BITS = 12;
+		static constexpr std::size_t TABLE_BITS = 12;
+		static constexpr std::size_t TABLE_SIZE = std::size_t(1) << TABLE_BITS;
+		static constexpr std::size_t PAGE_MASK = (std::size_t(1) << PAGE_BITS) - 1;
+		//Cells a sparse tape can address, half on each side of where it starts
+		static constexpr std::size_t SPARSE_SIZE = std::size_t(1) << 36;
+
+		Tape(std::size_t size = 0, TAPE_KIND kind = TAPE_FIXED);
+		Tape(Tape const &other);
+		Tape(Tape &&other) noexcept;
+		~Tape() { release(); }
+
+		Tape& operator=(Tape const &other);
+		Tape& operator=(Tape &&other) noexcept;
+
+		void snapshot();
+		bool restore();
+
+		void fPrint(std::size_t cell);
+		void fDump(DUMP_BASE base = BASE_HEX, bool ascii = false);
 
-		Tape& operator=(Tape const &other) { m_size = other.m_size; delete[] m_cells; m_cells = new unsigned char[m_size]; memcpy(m_cells, other.m_cells, m_size); return *this; }
+		std::size_t scanRight(std::size_t index, std::size_t stride);
+		std::size_t scanLeft(std::size_t index, std::size_t stride);
 
-		void fPrint(int cell);
-		void fDump(DUMP_BASE base = BASE_HEX, bool ascii = false);
+		bool isZero();
+		bool isGuard(const void *address);
 
 		inline unsigned char& operator[] (std::size_t index) {
 			if(index < 0 || index > m_size - 1) {
@@ -32,13 +67,58 @@ namespace bs {
 			}
 
 			outOfBounds = false;
-			return m_cells[index];
+			return cell(index);
+		}
+
+		//A cell that's known to be on the tape, sparse tapes get the page for it made if it wasn't touched yet
+		inline unsigned char& cell(std::size_t index) {
+			if(m_cells != nullptr)
+				return m_cells[index];
+
+			if(index >> PAGE_BITS != m_cachedPage)
+				cachePage(index);
+
+			return m_cachedCells[index & PAGE_MASK];
 		}
 
 		bool outOfBounds = false;
 		std::size_t m_size;
-		unsigned char m_dummy;
+		std::size_t m_start = 0; //Cell the data pointer starts on
+		TAPE_KIND m_kind = TAPE_FIXED;
+		unsigned char m_dummy = 0; //What accesses off the tape get instead of a cell
 		unsigned char *m_cells;
+		unsigned char *m_region = nullptr; //Start of the allocation, including the guards
+		std::size_t m_regionSize = 0;
+		std::size_t m_slack = 0; //Bytes after the last cell that are still mapped, up to the high guard at the next page
+
+	private:
+
+		//Pages and tables are shared with the snapshot until they're written
+		using Page = std::shared_ptr<unsigned char[]>;
+		using Table = std::vector<Page>;
+
+		std::vector<std::shared_ptr<Table>> m_directory; //Tables of pages for a sparse tape, m_cells is null for them
+		std::size_t m_cachedPage = SIZE_MAX; //The page cell() used last, so going through it in order doesn't need the table
+		unsigned char *m_cachedCells = nullptr;
+
+		bool m_snapshot = false; //Whether snapshot() was called
+		std::vector<std::shared_ptr<Table>> m_savedDirectory; //The directory when the snapshot was taken, for sparse tapes
+		int m_savedFile = -1; //File holding the cells when the snapshot was taken, mapped privately under them
+		std::vector<unsigned char> m_savedCells; //A plain copy of the cells, when they can't be mapped from a file
+
+		void allocate();
+		void release();
+		void copyCells(Tape const &other);
+		bool usedRange(std::size_t &first, std::size_t &last) const;
+	#if defined(USE_GUARD_PAGES)
+		bool saveDirtyPages();
+		bool mapSnapshot();
+	#endif
+		unsigned char* findPage(std::size_t index) const;
+		std::vector<std::size_t> touchedPages() const;
+		void cachePage(std::size_t index);
+		unsigned char peek(std::size_t index);
+		std::size_t scanSparse(std::size_t index, std::size_t stride, bool right);
 	};
 }
 
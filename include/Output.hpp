@@ -0,0 +1,55 @@
+#ifndef OUTPUT_HPP
+#define OUTPUT_HPP
+
+#include <cstddef>
+#include <iostream>
+#include <vector>
+
+namespace bs {
+
+	/**
+	 * Holds output in a buffer until it fills up, then writes all of it to the stream, or straight
+	 * to a file descriptor if one was set. There's always room for one more byte, so a byte can be
+	 * put before checking if it's full.
+	 */
+	class OutputWriter {
+	public:
+
+		OutputWriter(std::ostream &stream, std::size_t size);
+		~OutputWriter();
+
+		OutputWriter(const OutputWriter&) = delete;
+		OutputWriter& operator=(const OutputWriter&) = delete;
+
+		//How much output is held before it's written, 0 writes every byte
+		void setBufferSize(std::size_t size);
+		inline std::size_t getBufferSize() const { return m_buffer.size() - 1; }
+		//Writes to the file descriptor instead of the stream, -1 goes back to the stream
+		void setFile(int file);
+
+		inline void put(char c) {
+			*m_next++ = c;
+
+			if(m_next == m_end)
+				flush();
+		}
+
+		void write(const char *string, std::size_t length);
+		void flush();
+
+		//The free part of the buffer, compiled code puts bytes here itself and only calls in when it's full
+		char *m_next;
+		char *m_end;
+
+	private:
+
+		std::ostream &m_stream;
+		int m_file = -1;
+		std::vector<char> m_buffer;
+
+		void writeOut(const char *string, std::size_t length);
+	};
+
+}
+
+#endif //OUTPUT_HPP
@@ -0,0 +1,45 @@
+#ifndef PASS_MANAGER_HPP
+#define PASS_MANAGER_HPP
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bs {
+
+	struct Block;
+
+	//A pass rewrites the top level blocks of the loop tree in place
+	using Pass = std::function<void(std::vector<Block>&)>;
+
+	struct PassStats {
+		std::string name;
+		double millis; //Wall time the pass took
+		std::size_t tokensBefore;
+		std::size_t tokensAfter;
+	};
+
+	/**
+	 * Runs the registered passes over the loop tree in the order they were added,
+	 * recording how long each one took and how many tokens it got rid of.
+	 */
+	class PassManager {
+	public:
+
+		void add(const std::string &name, Pass pass);
+		void run(std::vector<Block> &blocks);
+		void clear();
+
+		inline const std::vector<PassStats>& getStats() { return m_stats; }
+
+	private:
+
+		std::vector<std::pair<std::string, Pass>> m_passes;
+		std::vector<PassStats> m_stats;
+	};
+
+}
+
+#endif //PASS_MANAGER_HPP
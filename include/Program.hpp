@@ -1,6 +1,8 @@
 #ifndef PROGRAM_HPP
 #define PROGRAM_HPP
 
+#include "PassManager.hpp"
+
 #include <string>
 #include <vector>
 #include <deque>
@@ -11,6 +13,7 @@ namespace bs {
 	struct Token {
 		char identifier;
 		unsigned int data;
+		int offset = 0; //Cell relative to the data pointer, for tokens that touch other cells
 	};
 
 	class Program {
@@ -18,6 +21,7 @@ namespace bs {
 	
 		std::string source; //Raw program, as string
 		std::vector<Token> tokens; //Preprocessed into Token intermediates
+		std::string constants; //Bytes printed by PRINT tokens
 		bool processed;
 
 		Program() : processed(false) { }
@@ -45,9 +49,27 @@ namespace bs {
 		OUTPUT = '.',
 		//Extended Tokens for optimization
 		CLEAR = 'z',
-		COPY = 'c'
+		MULTIPLY = 'm', //Adds the current cell times data to the cell at offset
+		SCAN_RIGHT = 'R', //Moves right data cells at a time until it reaches a zero cell
+		SCAN_LEFT = 'L',
+		SET = 's', //Stores data into the cell at offset
+		PRINT = 'p' //Prints data bytes from Program::constants, starting at offset
+	};
+
+	/**
+	 * A node of the loop tree, either a basic block, a straight run of tokens
+	 * without any brackets, or a loop holding the blocks of its body.
+	 */
+	struct Block {
+		enum Kind { BASIC, LOOP };
+
+		Kind kind;
+		std::vector<Token> tokens = {}; //Only used by basic blocks
+		std::vector<Block> children = {}; //Only used by loops
 	};
 
+	std::size_t countTokens(const std::vector<Block> &blocks);
+
 	class IREmitter {
 	public:
 
@@ -55,17 +77,25 @@ namespace bs {
 		IREmitter(const char *source);
 
 		void loadSource(const char *source);
-		void optimize(unsigned int level = 2);
+		void loadTokens(const Token *tokens, std::size_t count, const char *constants, std::size_t length);
+		void optimize(unsigned int level = 2, std::size_t knownTape = 0);
 		bool expr();
 		void tokenize();
 		Program emit();
 
 		inline std::string getError() { return m_error; };
+		inline const std::string& getSource() { return m_source.source; }
+		inline const std::vector<Block>& getTree() { return m_tree; }
+		inline const std::vector<PassStats>& getPassStats() { return m_passes.getStats(); }
 	
 	private:
 
 		Program m_source;
+		std::vector<Block> m_tree; //The structured form of m_source, built by expr()
+		PassManager m_passes;
 		std::string m_error;
+
+		void buildTree();
 	};
 
 }
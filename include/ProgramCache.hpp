@@ -0,0 +1,59 @@
+#ifndef PROGRAM_CACHE_HPP
+#define PROGRAM_CACHE_HPP
+
+#include "Program.hpp"
+
+#include <cstdint>
+#include <string>
+
+namespace bs {
+
+	//FNV-1a, continuing from hash so more than one piece can go into it
+	uint64_t hashBytes(const void *data, std::size_t length, uint64_t hash = 0xcbf29ce484222325);
+
+	bool validTokens(const Token *tokens, std::size_t count, std::size_t constantsLength);
+
+	/**
+	 * Keeps optimized programs as files in a directory, so the next time the same source
+	 * is loaded with the same settings the tokens can be read back instead of optimized again.
+	 * The files are named by a hash of the source and the settings, and mapped into memory to load.
+	 */
+	class ProgramCache {
+	public:
+
+		//Has to go up whenever the Token layout or what the optimizations produce changes
+		static constexpr uint32_t VERSION = 2;
+
+		//The start of every cache file
+		struct Header {
+			char magic[4]; //"BSIR"
+			uint32_t version;
+			uint64_t sourceHash;
+			uint64_t sourceLength;
+			uint64_t knownTape;
+			uint32_t level;
+			uint32_t tokenSize; //sizeof(Token), so a build with a different layout doesn't use it
+			uint64_t tokenCount;
+			uint64_t constantsLength;
+		};
+
+		ProgramCache(const std::string &directory = "");
+
+		inline void setDirectory(const std::string &directory) { m_directory = directory; }
+		inline const std::string& getDirectory() { return m_directory; }
+		inline bool enabled() { return !m_directory.empty(); }
+
+		bool load(IREmitter &emitter, unsigned int level, std::size_t knownTape);
+		bool store(IREmitter &emitter, unsigned int level, std::size_t knownTape);
+
+	private:
+
+		std::string m_directory;
+
+		Header makeHeader(const std::string &source, unsigned int level, std::size_t knownTape);
+		std::string path(const Header &header);
+	};
+
+}
+
+#endif //PROGRAM_CACHE_HPP
@@ -0,0 +1,40 @@
+#ifndef THREADED_INTERPRETER_HPP
+#define THREADED_INTERPRETER_HPP
+
+#include "Interpreter.hpp"
+#include "Decoder.hpp"
+
+#include <vector>
+
+namespace bs {
+
+	/**
+	 * An interpreter that decodes the program once into a dense array of
+	 * instructions and then dispatches straight from handler to handler,
+	 * using computed goto when the compiler supports it and a switch loop otherwise.
+	 */
+	class ThreadedInterpreter : public Interpreter {
+	public:
+
+		ThreadedInterpreter(std::ostream &stream = std::cout, bool numInput = false, std::size_t memSize = 30000, TAPE_KIND tape = TAPE_FIXED);
+		~ThreadedInterpreter();
+
+		bool loadProgram(const char *program, bool process = true, bool resetDataPtr = true, unsigned int optimization = 2) override;
+		bool run(float runSpeed = 0) override;
+		bool step() override;
+
+	private:
+
+		std::vector<Instruction> m_code;
+		std::vector<std::size_t> m_origin; //Index of the token each instruction was decoded from
+		std::size_t m_pc; //Index into m_code of the next instruction
+
+		template<typename Cells> bool dispatchThreaded(Cells cells);
+		template<typename Cells> bool dispatchSwitch(Cells cells, bool single);
+		bool memoryError(std::size_t pc, std::size_t dataPtr);
+		bool unmatchedError(std::size_t pc, std::size_t dataPtr);
+	};
+
+}
+
+#endif //THREADED_INTERPRETER_HPP
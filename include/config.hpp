@@ -1 +1,25 @@
-#define USE_JIT //Only x86_64 is supported so this should be disabled on other architectures
\ No newline at end of file
+#define USE_JIT //Only x86_64 is supported so this should be disabled on other architectures
+
+#if defined(__GNUC__) || defined(__clang__)
+#define USE_COMPUTED_GOTO //Labels as values are a GNU extension, the ThreadedInterpreter falls back to a switch loop without them
+#endif
+
+#if defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+#define USE_SSE2_SCAN //Scans for zero cells 16 at a time, otherwise they are checked one at a time
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define USE_MMAP //Cached programs and input files are mapped into memory and output can go straight to a file descriptor, otherwise they go through buffers and streams
+#endif
+
+#if defined(__linux__) && defined(__x86_64__)
+#define USE_GUARD_PAGES //The tape is mapped between inaccessible pages, so the JIT can catch accesses off the tape instead of crashing
+#endif
+
+#if defined(__linux__)
+#define USE_DUAL_MAPPING //Compiled code is written and run through two views of the same memory, otherwise its pages have their permissions changed after it's copied in
+#endif
+
+#if defined(USE_JIT) && defined(__linux__) && defined(__x86_64__)
+#define USE_AOT //Compiled programs can be written out as static executables that make their own system calls, the JIT generates their code
+#endif
\ No newline at end of file
@@ -0,0 +1,101 @@
+#ifndef JIT_CODE_CACHE_HPP
+#define JIT_CODE_CACHE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Program.hpp"
+#include "jit/Emitter.hpp"
+
+namespace bs {
+
+namespace jit {
+
+    //What an address the code loads with movabs is made from, so it can be filled in again in another process
+    enum RELOCATION_KIND : uint32_t {
+        RELOC_INSTANCE,  //The JITInterpreter running the code
+        RELOC_INPUT,     //Its input buffer pointers
+        RELOC_OUTPUT,    //Its output buffer pointers
+        RELOC_CONSTANTS, //The strings in its program
+        RELOC_FLUSH,     //func_flushOutput()
+        RELOC_GET_CHAR,  //func_getChar()
+        RELOC_PRINT      //func_print()
+    };
+
+    //Calling conventions the code can be generated for
+    enum CODE_ABI : uint32_t {
+        ABI_SYSTEM_V = 1,
+        ABI_WINDOWS = 2
+    };
+
+    //Build options the code depends on
+    enum CODE_FLAGS : uint32_t {
+        CODE_GUARD_PAGES = 1 //Accesses off the tape are caught by the guard pages instead of checked
+    };
+
+    //The address at location in the code is the one for kind plus addend
+    struct Relocation {
+        uint32_t kind;
+        uint32_t location;
+        uint64_t addend;
+    };
+
+    using CodeMap = std::vector<std::pair<std::size_t, std::size_t>>;
+
+    /**
+     * Keeps compiled programs as files in a directory, like the ProgramCache does for optimized ones.
+     * The code only has relative jumps, so with its relocations filled in it can run anywhere.
+     */
+    class CodeCache {
+    public:
+
+        //Has to go up whenever the code the JITInterpreter generates changes, x86_64Emitter::VERSION covers the encoders
+        static constexpr uint32_t VERSION = 7;
+
+        //The start of every cache file
+        struct Header {
+            char magic[4]; //"BSJT"
+            uint32_t version;
+            uint32_t emitterVersion;
+            uint32_t level;
+            uint64_t sourceHash;
+            uint64_t sourceLength;
+            uint64_t tapeSize;
+            uint64_t tapeStart;
+            uint64_t resume; //Where preRun() stopped, the code starts from there
+            uint32_t processed;
+            uint32_t numInput;
+            uint32_t abi;
+            uint32_t flags;
+            uint64_t tapeSlack;
+            uint64_t programSize; //Tokens or characters, the code map can't point past them
+            uint64_t constantsLength; //The printed constants can't be addressed past it
+            uint64_t codeSize;
+            uint64_t relocationCount;
+            uint64_t codeMapCount;
+        };
+
+        inline void setDirectory(const std::string &directory) { m_directory = directory; }
+        inline bool enabled() { return !m_directory.empty(); }
+
+        Header makeHeader(const Program &program, unsigned int level, bool numInput,
+                          std::size_t tapeSize, std::size_t tapeStart, std::size_t tapeSlack, std::size_t resume);
+
+        bool load(const Header &expected, x86_64Emitter &emitter, std::vector<Relocation> &relocations, CodeMap &codeMap);
+        bool store(Header header, const x86_64Emitter &emitter, const std::vector<Relocation> &relocations, const CodeMap &codeMap);
+
+    private:
+
+        std::string m_directory;
+
+        std::string path(const Header &header);
+    };
+
+} //namespace jit
+
+} //namespace bs
+
+#endif //JIT_CODE_CACHE_HPP
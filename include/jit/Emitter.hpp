@@ -3,26 +3,24 @@
 
 #define GET_BYTE(number, byte) number >> (8 * byte) & 0xff
 
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <memory>
+#include <type_traits>
 #include <vector>
-#include <string>
 
 namespace bs {
 
 namespace jit {
 
-    struct Label {
-        std::string name;
-        std::size_t location;
-        bool reference;
-
-        bool operator==(const Label &other) {
-            return name == other.name && location == other.location && reference == other.reference;
-        }
+    //A place in the code that jumps can go to, it's made by newLabel() and placed by bind()
+    using Label = uint32_t;
 
-        bool operator==(const std::string &other) {
-            return name == other;
-        }
+    //Where a jump's operand is, to fill in with the distance to its label once every label is placed
+    struct Patch {
+        std::size_t location;
+        Label label;
     };
 
     //64-bit registers
@@ -45,22 +43,59 @@ namespace jit {
         r15 = 15
     };
 
+    //128-bit SSE registers, only the ones that don't need a REX prefix
+    enum x64XMMRegister : uint8_t {
+        xmm0 = 0,
+        xmm1 = 1,
+        xmm2 = 2,
+        xmm3 = 3,
+        xmm4 = 4,
+        xmm5 = 5,
+        xmm6 = 6,
+        xmm7 = 7
+    };
+
     class x86_64Emitter {
     public:
 
-        std::vector<uint8_t> getCode();
-        std::size_t size();
+        static constexpr std::size_t UNBOUND = SIZE_MAX; //Location of a label that hasn't been placed yet
+
+        static constexpr uint32_t VERSION = 2; //Has to go up whenever an instruction is encoded differently, so cached code isn't used
+        static constexpr std::size_t INITIAL_CAPACITY = 1 << 16; //Bytes of code there's room for before it has to grow
+
+        x86_64Emitter();
+
+        inline const uint8_t* getCode() const { return m_code.get(); }
+        inline std::size_t size() const { return m_size; }
         void clear();
 
-        void emitBytes(std::vector<uint8_t> bytes);
+        //Writes the bytes to the end of the code, making room for all of them at once
+        template<typename... Bytes>
+        inline void emitBytes(Bytes... bytes) {
+            uint8_t *out = space(sizeof...(Bytes));
+            ((*out++ = static_cast<uint8_t>(bytes)), ...);
+        }
 
-        //Pushes a integer value into the byte vector in Little-Endian
+        //Copies code that was emitted before to the end
+        inline void emitCode(const uint8_t *code, std::size_t size) {
+            std::memcpy(space(size), code, size);
+        }
+
+        //Overwrites an integer that was already emitted at location, in Little-Endian
+        template<typename T, typename = typename std::enable_if<std::is_integral<T>::value, T>::type>
+        inline void patchInt(std::size_t location, T value) {
+            for(std::size_t i = 0; i < sizeof(T); i++) {
+                m_code[location + i] = GET_BYTE(value, i);
+            }
+        }
+
+        //Writes an integer value to the end of the code in Little-Endian
         template<typename T, typename = typename std::enable_if<std::is_integral<T>::value, T>::type>
-        void emitInt(T value) {
-            int num_bytes = sizeof(T);
+        inline void emitInt(T value) {
+            uint8_t *out = space(sizeof(T));
 
-            for(size_t i = 0; i < num_bytes; i++) {
-                m_code.push_back(GET_BYTE(value, i));
+            for(std::size_t i = 0; i < sizeof(T); i++) {
+                out[i] = GET_BYTE(value, i);
             }
         }
 
@@ -75,31 +110,80 @@ namespace jit {
         void mov(uint32_t immediate, x64GPRegister reg);        // mov imm32, %r
         void mov(x64GPRegister src, x64GPRegister dest);        // mov %src, %dest
         void mov_at_reg(x64GPRegister src, x64GPRegister dest); // movb (%src), %dest
-        void mov_at_reg(uint8_t immediate, x64GPRegister reg);  // movb imm8, (%r)
-        void mov_al_at_reg(x64GPRegister reg);                  // movb %al, (%r)
+        void mov_at_reg(uint8_t immediate, x64GPRegister reg, int32_t offset = 0); // movb imm8, offset(%r)
+        void mov_al_at_reg(x64GPRegister reg, int32_t offset = 0);                 // movb %al, offset(%r)
         void inc(x64GPRegister reg);                            // inc %r
         void dec(x64GPRegister reg);                            // dec %r
-        void addb_at_reg(uint8_t value, x64GPRegister reg);     // addb value, 0(%r) or in intel syntax: add BYTE PTR [%r + 0x0], value
-        void subb_at_reg(uint8_t value, x64GPRegister reg);     // subb value, 0(%r)
+        void addb_at_reg(uint8_t value, x64GPRegister reg, int32_t offset = 0); // addb value, offset(%r) or in intel syntax: add BYTE PTR [%r + offset], value
+        void subb_at_reg(uint8_t value, x64GPRegister reg, int32_t offset = 0); // subb value, offset(%r)
         void add_to_reg(uint32_t value, x64GPRegister reg);     // add imm32, %r
         void sub_from_reg(uint32_t value, x64GPRegister reg);   // sub imm32, %r
         void push_reg(x64GPRegister reg);                       // push %r
         void pop_reg(x64GPRegister reg);                        // pop %r
-        void cmpb_at_reg(uint8_t value, x64GPRegister reg);     // cmpb value, 0(%r)
+        void cmpb_at_reg(uint8_t value, x64GPRegister reg, int32_t offset = 0); // cmpb value, offset(%r)
+        void lea(x64GPRegister base, int32_t offset, x64GPRegister dest);       // lea offset(%base), %dest
         void jnz(int32_t relative);                             // jnz relative_address -- the same as jne
         void jz(int32_t relative);                              // jz relative_address -- the same as je
-        void jnz(const std::string &label_name);                // a jnz but with a label to be backpatched later
-        void jz(const std::string &label_name);                 // a jz but with a label to be backpatched later
+        void jnz(Label label);                                  // a jnz but with a label to be backpatched later
+        void jz(Label label);                                   // a jz but with a label to be backpatched later
         void call_at_reg(x64GPRegister reg);                    // call %r -- indirect absolute memory addressing with the register
-
-        void emitLabel(const std::string &label_name);
+        void movzxb_at_reg(x64GPRegister src, x64GPRegister dest, int32_t offset = 0);   // movzbl offset(%src), %dest
+        void imul(int32_t immediate, x64GPRegister reg);                                 // imul imm, %r, %r -- only the low 32-bits
+        void addb_reg_at_reg(x64GPRegister src, x64GPRegister dest, int32_t offset = 0); // addb %src, offset(%dest)
+        void subb_reg_at_reg(x64GPRegister src, x64GPRegister dest, int32_t offset = 0); // subb %src, offset(%dest)
+        void add_to_reg(x64GPRegister src, x64GPRegister dest);                         // add %src, %dest
+        void sub_from_reg(x64GPRegister src, x64GPRegister dest);                       // sub %src, %dest
+        void and_reg(uint32_t immediate, x64GPRegister reg);                            // and imm32, %r -- only the low 32-bits
+        void test(x64GPRegister src, x64GPRegister dest);                               // test %src, %dest -- only the low 32-bits
+        void bsf(x64GPRegister src, x64GPRegister dest);                                // bsf %src, %dest -- only the low 32-bits
+        void bsr(x64GPRegister src, x64GPRegister dest);                                // bsr %src, %dest -- only the low 32-bits
+        void jmp(Label label);                                                          // a jmp with a label to be backpatched later
+        void movdqu_at_reg(x64GPRegister src, x64XMMRegister dest, int32_t offset = 0); // movdqu offset(%src), %dest
+        void pxor(x64XMMRegister src, x64XMMRegister dest);                             // pxor %src, %dest
+        void pcmpeqb(x64XMMRegister src, x64XMMRegister dest);                          // pcmpeqb %src, %dest
+        void pmovmskb(x64XMMRegister src, x64GPRegister dest);                          // pmovmskb %src, %dest
+        void movq_at_reg(x64GPRegister src, x64GPRegister dest, int32_t offset = 0);     // movq offset(%src), %dest
+        void movq_reg_at_reg(x64GPRegister src, x64GPRegister dest, int32_t offset = 0); // movq %src, offset(%dest)
+        void cmp(x64GPRegister src, x64GPRegister dest);                                // cmp %src, %dest
+        void cmp_al(uint8_t value);                                                     // cmpb value, %al
+        void jle(Label label);                                                          // a jle with a label to be backpatched later
+        void syscall();                                                                 // syscall -- overwrites rcx and r11
+        void addb_reg(uint8_t value, x64GPRegister reg);                                // addb value, %r8 -- only al, cl, dl and bl
+        void subb_reg(uint8_t value, x64GPRegister reg);                                // subb value, %r8 -- only al, cl, dl and bl
+        void movb_reg(uint8_t value, x64GPRegister reg);                                // movb value, %r8 -- only al, cl, dl and bl
+        void movb_reg_at_reg(x64GPRegister src, x64GPRegister dest, int32_t offset = 0); // movb %src8, offset(%dest) -- only al, cl, dl and bl
+        void movzxb_reg(x64GPRegister src, x64GPRegister dest);                         // movzbl %src8, %dest -- only al, cl, dl and bl into the first 8
+        void testb(x64GPRegister src, x64GPRegister dest);                              // testb %src8, %dest8 -- only al, cl, dl and bl
+        void call(Label label);                                                         // a call with a label to be backpatched later, for routines in the same code
+        void jb(Label label);                                                           // a jb with a label to be backpatched later, for unsigned compares
+        void ja(Label label);                                                           // a ja with a label to be backpatched later, for unsigned compares
+        void jae(Label label);                                                          // a jae with a label to be backpatched later, for unsigned compares
+
+        Label newLabel();
+        void bind(Label label);
         bool resolveLabels();
 
     private:
 
-        std::vector<uint8_t> m_code;
-        std::vector<Label> m_src_labels;
-        std::vector<Label> m_ref_labels;
+        void emitMemOperand(uint8_t reg, x64GPRegister base, int32_t offset);
+        void grow(std::size_t count);
+
+        //Takes the next count bytes of the code to write into
+        inline uint8_t* space(std::size_t count) {
+            if(m_size + count > m_capacity)
+                grow(count);
+
+            uint8_t *out = m_code.get() + m_size;
+            m_size += count;
+
+            return out;
+        }
+
+        std::unique_ptr<uint8_t[]> m_code;
+        std::size_t m_size = 0;
+        std::size_t m_capacity = 0;
+        std::vector<std::size_t> m_labels; //Where each label was placed, indexed by the label
+        std::vector<Patch> m_patches;
     };
 
 } //namespace jit
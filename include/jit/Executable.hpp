@@ -0,0 +1,42 @@
+#ifndef JIT_EXECUTABLE_HPP
+#define JIT_EXECUTABLE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Input.hpp"
+#include "jit/Emitter.hpp"
+#include "jit/CodeCache.hpp"
+
+namespace bs {
+
+namespace jit {
+
+    //What the executable has to do the same way as the interpreter it was compiled by
+    struct ExecutableOptions {
+        std::size_t tapeSize;
+        std::size_t start;        //Cell the program starts on
+        EOF_POLICY eof;
+        bool raw;                 //Otherwise newlines are dropped from the input, which is what line mode does
+        std::size_t outputBuffer; //Output held before it's written, like OutputWriter
+        int32_t inputEnd;         //Offset of InputReader::m_end from m_next, the code reads them as a pair
+        int32_t outputEnd;        //Offset of OutputWriter::m_end from m_next
+    };
+
+    /**
+     * Writes compiled code out as a static Linux executable. It has the tape in its bss, with guard pages
+     * around it, and small routines in place of the interpreter's, which read and write through system calls.
+     *
+     * @param program Code compiled by the JITInterpreter, the relocations say where its addresses go
+     * @param error Set to what went wrong if it couldn't be written
+     */
+    bool writeExecutable(const std::string &path, const x86_64Emitter &program, const std::vector<Relocation> &relocations,
+                         const std::string &constants, const ExecutableOptions &options, std::string &error);
+
+} //namespace jit
+
+} //namespace bs
+
+#endif //JIT_EXECUTABLE_HPP
@@ -5,10 +5,20 @@
 #include <vector>
 #include <stack>
 #include <iostream>
+#include <utility>
+
+#include "config.hpp"
+
+#if defined(USE_GUARD_PAGES)
+#include <csetjmp>
+#include <csignal>
+#endif
 
 #include "Interpreter.hpp"
 #include "jit/Emitter.hpp"
 #include "jit/Runtime.hpp"
+#include "jit/CodeCache.hpp"
+#include "jit/Executable.hpp"
 
 namespace bs {
 
@@ -17,23 +27,86 @@ namespace jit {
     class JITInterpreter : public Interpreter {
     public:
         
-        JITInterpreter(std::ostream &stream = std::cout, bool numInput = false, std::size_t memSize = 30000);
+        JITInterpreter(std::ostream &stream = std::cout, bool numInput = false, std::size_t memSize = 30000, TAPE_KIND tape = TAPE_FIXED);
         ~JITInterpreter();
 
         bool loadProgram(const char *program, bool process = true, bool resetDataPtr = true, unsigned int optimization = 2) override;
 		bool run(float runSpeed = 0) override; //Run speed doesn't matter now, cause it can't be controlled, easily at least
 		bool step() override; //This doesn't do anything
+    #if defined(USE_AOT)
+        //Writes the loaded program out as an executable that runs on its own, it has to be loaded without running any of it ahead of time
+        bool writeExecutable(const std::string &path);
+    #endif
 
     private:
 
         JITRuntime m_runtime;
+        void *m_code = nullptr; //Where the compiled program was loaded
         x86_64Emitter m_jit_emitter;
+        CodeMap m_codeMap; //Code offset where each instruction starts, and its index in the program
+        CodeCache m_codeCache;
+        std::vector<Relocation> m_relocations; //Every address in the code, to fill in when it's loaded
+
+        //While compiling, the cell r13 points at is kept in rbx and only written back when the pointer moves, something reads it from the tape or at loop edges
+        bool m_cellLoaded = false; //Whether rbx has the cell
+        bool m_cellDirty = false;  //Whether rbx has changes the tape doesn't have yet
+        bool m_cellFlags = false;  //Whether the zero flag is still from the last change to bl, so loops don't have to test it again
+        //The first cell and one past the last are kept in r15 and r14. Going off the low end always faults, but the high end only does
+        //past the tape's slack, so when it has any accesses are checked against r14, unless they're inside of cells already touched.
+        //Those are from m_lowest to m_highest, as offsets from r13 since it last changed.
+        bool m_inRange = false;
+        int64_t m_lowest = 0;
+        int64_t m_highest = 0;
+        //Code after the program that faults on purpose when a check finds an access off the tape, so the checks themselves only branch forward when they fail
+        struct FaultStub {
+            Label entry;
+            Label skip; //Where to go instead of faulting when the current cell is zero, for multiplies
+            bool conditional;
+            std::size_t instruction; //Index in the program it's for
+        };
+        std::vector<FaultStub> m_faultStubs;
+        //The output buffer's next and end pointers are kept in r12 and rbp, and go back to m_output around every call
+        Label m_flushRoutine; //Writes the output buffer when it's full
+        Label m_inputRoutine; //Gets a byte once the input buffer is empty
+    #if defined(USE_AOT)
+        bool m_fromStart = false; //Whether the code runs the whole program on a fresh tape, like an executable does
+    #endif
+
+    #if defined(USE_GUARD_PAGES)
+        sigjmp_buf m_faultJump; //Where run() picks up when the code goes off the tape
+        uintptr_t m_faultAddress; //Instruction that faulted
+        uintptr_t m_faultCell; //Value of r13 when it faulted
+
+        friend void handleFault(int signal, siginfo_t *info, void *context);
+    #endif
 
         bool compile();
-        bool compileInstr(Token instr, unsigned int &label_counter, std::stack<unsigned int> &label_stack);
-        bool compileInstr(char instr, unsigned int &label_counter, std::stack<unsigned int> &label_stack);
+        bool loadCode();
+        uint64_t relocationBase(uint32_t kind);
+        void emitAddress(RELOCATION_KIND kind, uint64_t addend, x64GPRegister reg);
+    #if defined(USE_GUARD_PAGES)
+        bool memoryError();
+    #endif
+        void compileInstr(const Instruction &instr, std::stack<std::pair<Label, Label>> &loops);
+        bool compileInstr(char instr, std::stack<std::pair<Label, Label>> &loops);
+        void compileScan(bool right, unsigned int stride);
+        void compileInput(int32_t offset);
+        void compileOutput(int32_t offset);
+        void compileLoop(bool start, std::stack<std::pair<Label, Label>> &loops);
+        void compileRoutines();
+        void loadOutput();
+        void storeOutput();
+        void loadCell();
+        void storeCell();
+        void dropCell();
+        void checkCell(int32_t offset, bool accessed = true);
+        void compileEndCheck(x64GPRegister address);
+        Label faultStub(bool conditional = false, Label skip = 0);
+        void compileFaultStubs();
 
-        friend char func_getChar(JITInterpreter *instance);
+        friend unsigned char func_getChar(JITInterpreter *instance, unsigned char current);
+        friend void func_flushOutput(JITInterpreter *instance);
+        friend void func_print(JITInterpreter *instance, const char *string, std::size_t length);
     };
 
 } //namespace jit
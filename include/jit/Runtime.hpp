@@ -1,36 +1,58 @@
 #ifndef JIT_RUNTIME_HPP
 #define JIT_RUNTIME_HPP
 
+#include <cstddef>
 #include <cstdint>
-#include <vector>
+#include <map>
+
+#include "config.hpp"
 
 namespace bs {
 
 namespace jit {
 
-    using JITFunc = void (*)(uint64_t *tape_memory);
+    //Takes the cell to start on and the bounds of the tape, and returns the cell it finished on
+    using JITFunc = unsigned char *(*)(uint64_t *tape_memory, unsigned char *tape_start, unsigned char *tape_end);
 
+    /**
+     * Keeps compiled code where it can run. With dual mapping the code is in one file mapped twice, written through
+     * a writable view and run from an executable one, so loading never changes any permissions. Space is handed out
+     * from the front of the file and reused once the code in it is freed.
+     * Otherwise each piece of code gets its own pages, which are made executable after it's copied in. That's also what
+     * happens when the file can't be made or mapped, like under seccomp or on kernels without memfd_create().
+     */
     class JITRuntime {
     public:
 
+        static constexpr std::size_t CACHE_SIZE = std::size_t(1) << 28; //Address space kept for code, only what's written uses memory
+        static constexpr std::size_t ALIGNMENT = 64; //Every piece of code starts on its own cache line
+
         JITRuntime();
         ~JITRuntime();
 
-        void loadCode(const std::vector<uint8_t> &code);
-        void* getMemory();
-        bool isExecutable();
+        JITRuntime(const JITRuntime&) = delete;
+        JITRuntime& operator=(const JITRuntime&) = delete;
+
+        //Copies the code in and returns where it runs from, nullptr if there isn't any room left
+        void* loadCode(const uint8_t *code, std::size_t size);
+        //Gives back the space code was loaded into
+        void freeCode(void *code);
 
     private:
 
-        void createBuffer();
-        void freeBuffer();
-        void protectBuffer();
-        void resizeBuffer(size_t pages);
+        std::map<uintptr_t, std::size_t> m_blocks; //Where each piece of code that's loaded starts, and the size of its space
+        std::size_t m_page_size;
+
+    #if defined(USE_DUAL_MAPPING)
+        std::map<std::size_t, std::size_t> m_free; //Offset and size of the freed space before m_used, neighbours are merged
+        std::size_t m_used = 0; //Everything from here to the end of the file has never been used
+        int m_file = -1;
+        uint8_t *m_writable = nullptr;
+        uint8_t *m_executable = nullptr; //Stays nullptr when the file couldn't be mapped
 
-        bool m_isExecutable;
-        size_t m_page_size;
-        size_t m_mem_size;
-        uint8_t *m_memory;
+        std::size_t allocate(std::size_t size);
+        void release(std::size_t offset, std::size_t size);
+    #endif
     };
 
 } //namespace jit
@@ -0,0 +1,120 @@
+#include "Decoder.hpp"
+
+#include <algorithm>
+
+namespace bs {
+
+	//Offsets have to fit in the 24 bits of Instruction::offset
+	const int MAX_OFFSET = (1 << 23) - 1;
+
+	//Maps the token identifiers to the dense opcodes, returns OP_COUNT for comments
+	Opcode opcodeOf(char identifier) {
+		switch(identifier) {
+			case SHIFT_RIGHT : return OP_SHIFT_RIGHT;
+			case SHIFT_LEFT : return OP_SHIFT_LEFT;
+			case INCREMENT : return OP_INCREMENT;
+			case DECREMENT : return OP_DECREMENT;
+			case START_LOOP : return OP_START_LOOP;
+			case END_LOOP : return OP_END_LOOP;
+			case INPUT : return OP_INPUT;
+			case OUTPUT : return OP_OUTPUT;
+			case PRINT : return OP_PRINT;
+			case CLEAR : return OP_CLEAR;
+			case SET : return OP_SET;
+			case MULTIPLY : return OP_MULTIPLY;
+			case SCAN_RIGHT : return OP_SCAN_RIGHT;
+			case SCAN_LEFT : return OP_SCAN_LEFT;
+			default : return OP_COUNT;
+		}
+	}
+
+	bool decode(const Program &program, std::vector<Instruction> &code, std::vector<std::size_t> &origin, std::string &error, bool unmatched) {
+		std::vector<std::size_t> openLoops;
+
+		code.clear();
+		origin.clear();
+		code.reserve(program.tokens.size() + 1);
+		origin.reserve(program.tokens.size() + 1);
+
+		for(std::size_t i = 0; i < program.tokens.size(); i++) {
+			const Token &token = program.tokens[i];
+			Opcode op = opcodeOf(token.identifier);
+			uint32_t data = token.data;
+			int offset = token.offset;
+
+			if(op == OP_COUNT)
+				continue; //Comments
+
+			if(op == OP_START_LOOP) {
+				openLoops.push_back(code.size());
+			} else if(op == OP_END_LOOP && openLoops.empty()) {
+				if(!unmatched) {
+					error = "Too many ']' for open loops '['";
+					return false;
+				}
+
+				op = OP_UNMATCHED;
+				data = END_LOOP;
+			} else if(op == OP_END_LOOP) {
+				data = openLoops.back();
+				code[openLoops.back()].data = code.size();
+				openLoops.pop_back();
+			}
+
+			//The start in the constants goes in data, since it can be past what the offset holds. The length goes in the offset
+			//instead, split over as many prints as it takes to fit.
+			if(op == OP_PRINT) {
+				std::size_t start = token.offset;
+				std::size_t length = token.data;
+
+				do {
+					std::size_t piece = std::min<std::size_t>(length, MAX_OFFSET);
+
+					code.push_back(Instruction{op, static_cast<int>(piece), static_cast<uint32_t>(start)});
+					origin.push_back(i);
+					start += piece;
+					length -= piece;
+				} while(length != 0);
+
+				continue;
+			}
+
+			if(offset > MAX_OFFSET || offset < -MAX_OFFSET) {
+				//The multiply reads the current cell, so the pointer can't be moved for it
+				if(op == OP_MULTIPLY) {
+					error = "Offset too large to decode at token " + std::to_string(i + 1);
+					return false;
+				}
+
+				Opcode there = offset > 0 ? OP_SHIFT_RIGHT : OP_SHIFT_LEFT;
+				Opcode back = offset > 0 ? OP_SHIFT_LEFT : OP_SHIFT_RIGHT;
+				uint32_t distance = offset > 0 ? offset : -static_cast<int64_t>(offset);
+
+				code.push_back(Instruction{there, 0, distance});
+				code.push_back(Instruction{op, 0, data});
+				code.push_back(Instruction{back, 0, distance});
+				origin.insert(origin.end(), 3, i);
+				continue;
+			}
+
+			code.push_back(Instruction{op, offset, data});
+			origin.push_back(i);
+		}
+
+		if(!openLoops.empty() && !unmatched) {
+			error = "Too many '[' for closed loops ']'";
+			return false;
+		}
+
+		for(std::size_t loop : openLoops) {
+			code[loop].op = OP_UNMATCHED;
+			code[loop].data = START_LOOP;
+		}
+
+		code.push_back(Instruction{OP_HALT, 0, 0});
+		origin.push_back(program.tokens.size());
+
+		return true;
+	}
+
+}
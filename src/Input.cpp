@@ -0,0 +1,110 @@
+#include "config.hpp"
+#include "Input.hpp"
+
+#if defined(USE_MMAP)
+#include <cerrno>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cstdio>
+#include <iostream>
+
+namespace bs {
+
+	InputReader::InputReader() { }
+
+	InputReader::~InputReader() {
+	#if defined(USE_MMAP)
+		if(m_mapped != nullptr)
+			munmap(m_mapped, m_mappedSize);
+	#endif
+	}
+
+	/**
+	 * Fills the buffer once everything in it was read.
+	 *
+	 * @return False if the input ended.
+	 */
+	bool InputReader::refill() {
+		if(m_ended)
+			return false;
+
+		if(!m_raw) {
+			m_line.clear();
+
+			//If there was nothing entered prompt again
+			while(m_line.empty()) {
+				if(!std::getline(std::cin, m_line)) {
+					m_ended = true;
+					return false;
+				}
+			}
+
+			m_next = reinterpret_cast<const unsigned char*>(m_line.data());
+			m_end = m_next + m_line.size();
+
+			return true;
+		}
+
+		if(m_mapped == nullptr && m_buffer.empty() && mapInput())
+			return true;
+
+		m_buffer.resize(BUFFER_SIZE);
+
+	#if defined(USE_MMAP)
+		ssize_t length;
+
+		do {
+			length = read(STDIN_FILENO, m_buffer.data(), m_buffer.size());
+		} while(length < 0 && errno == EINTR);
+	#else
+		std::size_t length = std::fread(m_buffer.data(), 1, m_buffer.size(), stdin);
+	#endif
+
+		if(length <= 0) {
+			m_ended = true;
+			return false;
+		}
+
+		m_next = m_buffer.data();
+		m_end = m_next + length;
+
+		return true;
+	}
+
+	/**
+	 * Maps the standard input when it's a regular file, so it never has to be copied.
+	 * The file position is moved to the end, so reading after the map ends finds anything added since.
+	 *
+	 * @return False if it isn't a file, or it couldn't be mapped.
+	 */
+	bool InputReader::mapInput() {
+	#if defined(USE_MMAP)
+		struct stat info;
+		off_t position = lseek(STDIN_FILENO, 0, SEEK_CUR);
+
+		if(position < 0 || fstat(STDIN_FILENO, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size <= position)
+			return false;
+
+		void *mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, STDIN_FILENO, 0);
+
+		if(mapped == MAP_FAILED)
+			return false;
+
+		madvise(mapped, info.st_size, MADV_SEQUENTIAL);
+		lseek(STDIN_FILENO, info.st_size, SEEK_SET);
+
+		m_mapped = mapped;
+		m_mappedSize = info.st_size;
+		m_next = static_cast<const unsigned char*>(mapped) + position;
+		m_end = static_cast<const unsigned char*>(mapped) + info.st_size;
+
+		return true;
+	#else
+		return false;
+	#endif
+	}
+
+}
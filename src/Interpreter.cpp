@@ -1,5 +1,8 @@
 #include "Interpreter.hpp"
+#include "Decoder.hpp"
 
+#include <algorithm>
+#include <cctype>
 #include <chrono>
 #include <thread>
 
@@ -15,93 +18,201 @@ namespace bs {
 			error += instruction;
 			error += "' at character ";
 			error += std::to_string(instPtr + 1);
-			memory[0]; //This is just to reset the error value internally
+			memory.outOfBounds = false;
 		}
 
 		return error;
 	}
 
-	size_t handleStartLoop(unsigned char value, Program &program, std::size_t instPtr, bool &success) {
-		success = true;
-		
-		if(value == 0) {
-			unsigned int open = 0;
-
-			//Search for ending bracket
-			for(std::size_t i = instPtr + 1; i < program.source.size(); i++) {
-				if(program.source[i] == ']')
-					if(open == 0)
-						return i;
-					else
-						open--;
-				else if(program.source[i] == '[')
-					open++;
-			}
+	//Marks a bracket without a match in the bracket table, sources are limited to less than this
+	const uint32_t NO_MATCH = UINT32_MAX;
 
-			//Couldn't find ending bracket
-			success = false;
+	/**
+	 * Matches up the brackets of the source in one pass, and finds the next command
+	 * from every position so comments can be skipped without looking at them.
+	 *
+	 * @param brackets Set to the position of the matching bracket for each bracket, NO_MATCH if there isn't one
+	 * @param next Set to the position of the first command at or after each position, with one extra for the end
+	 */
+	void matchBrackets(const std::string &source, std::vector<uint32_t> &brackets, std::vector<uint32_t> &next) {
+		std::vector<uint32_t> openLoops;
+
+		brackets.assign(source.size(), NO_MATCH);
+		next.resize(source.size() + 1);
+		next[source.size()] = source.size();
+
+		for(std::size_t i = 0; i < source.size(); i++) {
+			if(source[i] == START_LOOP) {
+				openLoops.push_back(i);
+			} else if(source[i] == END_LOOP && !openLoops.empty()) {
+				brackets[i] = openLoops.back();
+				brackets[openLoops.back()] = i;
+				openLoops.pop_back();
+			}
+		}
 
-			return 1;
-		} else {
-			//Indicates that this bracket should be pushed onto the jump table
-			return 0; 
+		for(std::size_t i = source.size(); i-- > 0;) {
+			switch(source[i]) {
+				case SHIFT_RIGHT : case SHIFT_LEFT : case INCREMENT : case DECREMENT :
+				case START_LOOP : case END_LOOP : case INPUT : case OUTPUT :
+					next[i] = i;
+				break;
+				default : next[i] = next[i + 1];
+			}
 		}
 	}
 
 
 	//--------------- Interpreter Methods and Constructors ---------------//
 
-	Interpreter::Interpreter(std::ostream &stream, bool numInput, std::size_t memSize) : m_stream(stream), m_numInput(numInput), m_instPtr(0), m_dataPtr(0) {
-		m_memory = Tape(memSize);
-	}
+	Interpreter::Interpreter(std::ostream &stream, bool numInput, std::size_t memSize, TAPE_KIND tape) : m_output(stream, OUTPUT_BUFFER_SIZE), m_memory(memSize, tape), m_numInput(numInput), m_instPtr(0), m_dataPtr(m_memory.m_start), m_preRunBudget(PRE_RUN_BUDGET) { }
 
 	Interpreter::~Interpreter() { }
 
-	char Interpreter::getChar() {
-		char temp;
+	/**
+	 * Tokenizes and optimizes the source loaded in m_emitter, or gets the optimized
+	 * tokens from the cache if the same source was optimized the same way before.
+	 *
+	 * @return False if the program has invalid syntax.
+	 */
+	bool Interpreter::processProgram(unsigned int optimization, bool resetDataPtr) {
+		//Constants can only be worked out from a fresh tape
+		std::size_t knownTape = resetDataPtr && m_memory.isZero() ? m_memory.m_size - m_memory.m_start : 0;
+
+		if(optimization > 0 && m_cache.load(m_emitter, optimization, knownTape))
+			return true;
 
-		if(m_inBuffer.empty()) {
-			std::string input;
-			
-			//If there was nothing entered prompt again
-			while(input == "")
-				std::getline(std::cin, input);
+		m_emitter.tokenize();
+
+		if(!m_emitter.expr()) { m_error = m_emitter.getError(); return false; } //Program has invalid syntax
+
+		if(optimization > 0) {
+			m_emitter.optimize(optimization, knownTape);
+			m_cache.store(m_emitter, optimization, knownTape);
+		}
+
+		return true;
+	}
+
+	/**
+	 * Runs a token for preRun(), unless it reads input or would go off the tape.
+	 *
+	 * @return False if the token has to be left for the real run.
+	 */
+	bool preRunToken(Tape &memory, const Program &program, const Token &token, std::size_t &instPtr, std::size_t &dataPtr, std::string &output) {
+		std::size_t size = memory.m_size;
+		std::size_t cell = dataPtr + token.offset; //Negative cells wrap around to huge values
+
+		switch(token.identifier) {
+			case SHIFT_RIGHT : dataPtr += token.data;
+			break;
+			case SHIFT_LEFT : dataPtr -= token.data;
+			break;
+			case INCREMENT : if(cell >= size) return false;
+				memory.cell(cell) += token.data;
+			break;
+			case DECREMENT : if(cell >= size) return false;
+				memory.cell(cell) -= token.data;
+			break;
+			case START_LOOP : if(dataPtr >= size) return false;
+				if(memory.cell(dataPtr) == 0) instPtr = token.data;
+			break;
+			case END_LOOP : if(dataPtr >= size) return false;
+				if(memory.cell(dataPtr) != 0) instPtr = token.data;
+			break;
+			case INPUT : return false;
+			case OUTPUT : if(cell >= size) return false;
+				output += memory.cell(cell);
+			break;
+			case PRINT : output.append(program.constants, token.offset, token.data);
+			break;
+			case CLEAR : if(cell >= size) return false;
+				memory.cell(cell) = 0;
+			break;
+			case SET : if(cell >= size) return false;
+				memory.cell(cell) = token.data;
+			break;
+			case MULTIPLY : if(dataPtr >= size || cell >= size) return false;
+				memory.cell(cell) += memory.cell(dataPtr) * token.data;
+			break;
+			case SCAN_RIGHT : case SCAN_LEFT : {
+				std::size_t zero = token.identifier == SCAN_RIGHT ? memory.scanRight(dataPtr, token.data) : memory.scanLeft(dataPtr, token.data);
 
-			for(std::size_t i = 0; i < input.length(); i++) {
-				m_inBuffer.push_front(input[i]);
+				if(zero >= size) return false;
+				dataPtr = zero;
 			}
+			break;
 		}
 
-		temp = m_inBuffer.back();
-		m_inBuffer.pop_back();
+		return true;
+	}
+
+	/**
+	 * Runs the processed program from m_instPtr before it's compiled or interpreted, up to the
+	 * first input, an instruction that would fail, or the budget. The program then starts from
+	 * where this stopped, with the tape and pointer it left. Programs that never read input
+	 * can finish here completely, which leaves just their output to write.
+	 */
+	void Interpreter::preRun() {
+		std::size_t instPtr = m_instPtr;
+		std::size_t dataPtr = m_dataPtr;
+
+		m_preOutput.clear();
+
+		for(std::size_t steps = 0; steps < m_preRunBudget && instPtr < m_program.tokens.size(); steps++) {
+			if(!preRunToken(m_memory, m_program, m_program.tokens[instPtr], instPtr, dataPtr, m_preOutput))
+				break;
+
+			instPtr++;
+		}
+
+		m_instPtr = instPtr;
+		m_dataPtr = dataPtr;
+	}
+
+	//Puts what preRun() printed into the output, it's called before running so it comes out in order
+	void Interpreter::flushPreRun() {
+		if(!m_preOutput.empty()) {
+			putString(m_preOutput.data(), m_preOutput.size());
+			m_preOutput.clear();
+		}
+	}
+
+	/**
+	 * Reads a byte of input for a cell. With -n a number of up to 3 digits is read as its value instead.
+	 *
+	 * @param current What the cell has now, it keeps it at the end of the input with EOF_UNCHANGED
+	 */
+	unsigned char Interpreter::getChar(unsigned char current) {
+		unsigned char byte;
+
+		//Anything printed before asking for input has to show up first
+		if(m_input.m_next == m_input.m_end)
+			flushOutput();
+
+		if(!m_input.next(byte))
+			return m_eofPolicy == EOF_ZERO ? 0 : m_eofPolicy == EOF_MINUS_ONE ? 255 : current;
 
 		//-n should the input be converted, if possible
-		if(m_numInput) {
-			if(std::isdigit(temp)) {
-				std::string num;
-				num += temp;
-				temp = m_inBuffer.back();
-				
-				//Keep getting digits as long as it is under 256
-				while(std::isdigit(temp) && !m_inBuffer.empty()) {
-					if(std::stoi(num + temp) < 256) {
-						num += temp;
-						m_inBuffer.pop_back();
-					} else break;
-					temp = m_inBuffer.back();
-				}
-				
-				temp = static_cast<char>(std::stoi(num));
+		if(m_numInput && std::isdigit(byte)) {
+			unsigned int number = byte - '0';
+
+			//Keep getting digits as long as it is under 256, only from what was already read
+			while(m_input.m_next != m_input.m_end && std::isdigit(*m_input.m_next) && number * 10 + (*m_input.m_next - '0') < 256) {
+				number = number * 10 + (*m_input.m_next - '0');
+				m_input.m_next++;
 			}
+
+			byte = number;
 		}
 
-		return temp;
+		return byte;
 	}
 
 
 	//--------------- BasicInterpreter Implementation ---------------//
 
-	BasicInterpreter::BasicInterpreter(std::ostream &stream, bool numInput, std::size_t memSize) : Interpreter(stream, numInput, memSize) { }
+	BasicInterpreter::BasicInterpreter(std::ostream &stream, bool numInput, std::size_t memSize, TAPE_KIND tape) : Interpreter(stream, numInput, memSize, tape) { }
 	
 	BasicInterpreter::~BasicInterpreter() { }
 
@@ -111,22 +222,30 @@ namespace bs {
 		m_instPtr = 0;
 
 		if(resetDataPtr)
-			m_dataPtr = 0;
-
-		if(process) {
-			m_emitter.tokenize();
+			m_dataPtr = m_memory.m_start;
 
-			if(!m_emitter.expr()) { m_error = m_emitter.getError(); return false; } //Program has invalid syntax
+		if(process && !processProgram(optimization, resetDataPtr))
+			return false;
 
-			if(optimization > 0) {
-				m_emitter.optimize(optimization);
+		m_program = m_emitter.emit();
 
-				//This is called to update the jump locations of the brackets
-				if(!m_emitter.expr()) { m_error = m_emitter.getError(); return false; } //If there was an error in the optimizing, which shouldn't happen
+		if(!process) {
+			if(m_program.source.size() >= NO_MATCH) {
+				m_error = "Program too large to run unprocessed";
+				return false;
 			}
-		}
 
-		m_program = m_emitter.emit();
+			matchBrackets(m_program.source, m_brackets, m_next);
+		} else {
+			preRun();
+
+			if(!decode(m_program, m_code, m_origin, m_error))
+				return false;
+
+			//Pick up wherever preRun() stopped
+			m_pc = std::lower_bound(m_origin.begin(), m_origin.end(), m_instPtr) - m_origin.begin();
+			m_instPtr = m_origin[m_pc];
+		}
 
 		return true;
 	}
@@ -135,47 +254,65 @@ namespace bs {
 		if(m_program.tokens.empty()) {
 			m_error = "No program provided";
 			return false;
-		} else if(m_instPtr > m_program.tokens.size()) {
-			m_error = "Execution gone past end of program";
-			return false;
 		}
 
-		Token inst = m_program.tokens[m_instPtr];
+		Instruction inst = m_code[m_pc];
 
-		switch(inst.identifier) {
-			case SHIFT_RIGHT : m_dataPtr += inst.data;
+		switch(inst.op) {
+			case OP_SHIFT_RIGHT : m_dataPtr += inst.data;
+			break;
+			case OP_SHIFT_LEFT : m_dataPtr -= inst.data;
 			break;
-			case SHIFT_LEFT : m_dataPtr -= inst.data;
+			case OP_INCREMENT : m_memory[m_dataPtr + inst.offset] += inst.data;
 			break;
-			case INCREMENT : m_memory[m_dataPtr] += inst.data;
+			case OP_DECREMENT : m_memory[m_dataPtr + inst.offset] -= inst.data;
 			break;
-			case DECREMENT : m_memory[m_dataPtr] -= inst.data;
+			case OP_START_LOOP : if(m_memory[m_dataPtr] == 0) m_pc = inst.data;
 			break;
-			case START_LOOP : if(m_memory[m_dataPtr] == 0) m_instPtr = inst.data;
+			case OP_END_LOOP : if(m_memory[m_dataPtr] != 0) m_pc = inst.data;
+			break;
+			case OP_INPUT : {
+				unsigned char &cell = m_memory[m_dataPtr + inst.offset];
+				cell = getChar(cell);
+			}
 			break;
-			case END_LOOP : if(m_memory[m_dataPtr] != 0) m_instPtr = inst.data;
+			case OP_OUTPUT : putChar(m_memory[m_dataPtr + inst.offset]);
 			break;
-			case INPUT : m_memory[m_dataPtr] = getChar();
+			case OP_PRINT : putString(m_program.constants.data() + inst.data, inst.offset);
 			break;
-			case OUTPUT : m_stream << m_memory[m_dataPtr] << std::flush;
+			case OP_CLEAR : m_memory[m_dataPtr + inst.offset] = 0;
 			break;
-			case CLEAR : m_memory[m_dataPtr] = 0;
+			case OP_SET : m_memory[m_dataPtr + inst.offset] = inst.data;
 			break;
-			case COPY : m_memory[m_dataPtr + 1] = m_memory[m_dataPtr];
-				    m_memory[m_dataPtr + 2] = m_memory[m_dataPtr];
-				    m_memory[m_dataPtr] = 0;
+			case OP_SCAN_RIGHT : m_dataPtr = m_memory.scanRight(m_dataPtr, inst.data);
+					  m_memory[m_dataPtr]; //Sets the error if the scan went off the tape
+			break;
+			case OP_SCAN_LEFT : m_dataPtr = m_memory.scanLeft(m_dataPtr, inst.data);
+					 m_memory[m_dataPtr];
+			break;
+			case OP_MULTIPLY : {
+				unsigned char value = m_memory[m_dataPtr];
+
+				//Nothing is touched when the loop wouldn't have run
+				if(value != 0 && !m_memory.outOfBounds)
+					m_memory[m_dataPtr + inst.offset] += value * inst.data;
+			}
+			break;
+			case OP_HALT :
+				m_error = "Execution gone past end of program";
+				return false;
+			default :
 			break;
 		}
 
-		//Check for out-of-bounds memory access
-		std::string error = checkMemoryError(m_memory, inst.identifier, m_instPtr);
-		if(error != "") {
-			m_error = error;
+		//Check for out-of-bounds memory access, the message is only built when there is one
+		if(m_memory.outOfBounds) {
+			m_error = checkMemoryError(m_memory, m_program.tokens[m_instPtr].identifier, m_instPtr);
 			return false;
 		}
 
-
-		m_instPtr++;
+		m_pc++;
+		m_instPtr = m_origin[m_pc];
 
 		return true;
 	}
@@ -186,9 +323,13 @@ namespace bs {
 			return false;
 		}
 
+		//Comments aren't steps, so go straight to the next command
+		m_instPtr = m_next[m_instPtr];
+
+		if(m_instPtr == m_program.source.size())
+			return true;
+
 		char inst = m_program.source[m_instPtr];
-		std::size_t jumpValue;
-		bool success;
 
 		switch(inst) {
 			case SHIFT_RIGHT : m_dataPtr++;
@@ -200,22 +341,20 @@ namespace bs {
 			case DECREMENT : m_memory[m_dataPtr]--;
 			break;
 			case START_LOOP :
-				jumpValue = handleStartLoop(m_memory[m_dataPtr], m_program, m_instPtr, success);
-
-				if(jumpValue == 0) {
-					m_jumpTable.push_back(m_instPtr);	
-				} else if(success) {
-					m_instPtr = jumpValue;
-				} else {
-					m_error = "No matching bracket ] for instruction '";
-					m_error	+= inst;
-					m_error	+= "' at character ";
-					m_error += std::to_string(m_instPtr + 1);
-					return false;
+				if(m_memory[m_dataPtr] == 0) {
+					if(m_brackets[m_instPtr] == NO_MATCH) {
+						m_error = "No matching bracket ] for instruction '";
+						m_error	+= inst;
+						m_error	+= "' at character ";
+						m_error += std::to_string(m_instPtr + 1);
+						return false;
+					}
+
+					m_instPtr = m_brackets[m_instPtr];
 				}
 			break;
 			case END_LOOP : 
-				if(m_jumpTable.empty()) {
+				if(m_brackets[m_instPtr] == NO_MATCH) {
 					m_error = "No matching bracket [ for instruction '";
 					m_error += inst;
 					m_error += "' at character ";
@@ -223,26 +362,25 @@ namespace bs {
 					return false;
 				}
 
-				if(m_memory[m_dataPtr] != 0) {
-					m_instPtr = m_jumpTable.back();
-				} else {
-					m_jumpTable.pop_back();
-				}
+				if(m_memory[m_dataPtr] != 0)
+					m_instPtr = m_brackets[m_instPtr];
 			break;
-			case INPUT : m_memory[m_dataPtr] = getChar();
+			case INPUT : {
+				unsigned char &cell = m_memory[m_dataPtr];
+				cell = getChar(cell);
+			}
 			break;
-			case OUTPUT : m_stream << m_memory[m_dataPtr] << std::flush;
+			case OUTPUT : putChar(m_memory[m_dataPtr]);
 			break;
 		}
 
 		//Check for out-of-bounds access
-		std::string error = checkMemoryError(m_memory, inst, m_instPtr);
-		if(error != "") {
-			m_error = error;
+		if(m_memory.outOfBounds) {
+			m_error = checkMemoryError(m_memory, inst, m_instPtr);
 			return false;
 		}
 
-		m_instPtr++;
+		m_instPtr = m_next[m_instPtr + 1];
 
 		return true;
 	}
@@ -253,10 +391,13 @@ namespace bs {
 	* @return True if the instruction was executed successfully.
 	*/
 	bool BasicInterpreter::step() {
-		if(m_program.processed)
-			return stepProcessed();
-		else
-			return stepUnprocessed();
+		flushPreRun();
+
+		bool success = m_program.processed ? stepProcessed() : stepUnprocessed();
+
+		flushOutput();
+
+		return success;
 	}
 
 	/**
@@ -268,6 +409,8 @@ namespace bs {
 	* @return True if the program executed successfully.
 	*/
 	bool BasicInterpreter::run(float runSpeed) {
+		flushPreRun();
+
 		if(runSpeed < 0)
 			runSpeed = 0; //Just set zero for anything negative
 		
@@ -275,11 +418,11 @@ namespace bs {
 
 		if(!regulate) {
 			if(m_program.processed) {
-				while(m_instPtr < m_program.tokens.size())
-					if(!stepProcessed()) return false;
+				while(m_code[m_pc].op != OP_HALT)
+					if(!stepProcessed()) { flushOutput(); return false; }
 			} else {
 				while(m_instPtr < m_program.source.size()) {
-					if(!stepUnprocessed()) return false;
+					if(!stepUnprocessed()) { flushOutput(); return false; }
 				}
 			}
 		} else {
@@ -291,7 +434,7 @@ namespace bs {
 			auto lastTime = currentTime;
 
 			if(m_program.processed) {
-				while(m_instPtr < m_program.tokens.size()) {
+				while(m_code[m_pc].op != OP_HALT) {
 					currentTime = std::chrono::steady_clock::now();
 					delta = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - lastTime);
 					lastTime = currentTime;
@@ -301,7 +444,7 @@ namespace bs {
 						std::this_thread::sleep_for(delta - execTime);
 					}
 
-					if(!stepProcessed()) return false;
+					if(!stepProcessed()) { flushOutput(); return false; }
 				}
 			} else {
 				while(m_instPtr < m_program.source.size()) {
@@ -314,11 +457,13 @@ namespace bs {
 						std::this_thread::sleep_for(delta - execTime);
 					}
 
-					if(!stepUnprocessed()) return false;
+					if(!stepUnprocessed()) { flushOutput(); return false; }
 				}
 			}
 		}
 
+		flushOutput();
+
 		return true;
 	}
 
@@ -1,13 +1,28 @@
+#include "config.hpp"
 #include "Memory.hpp"
 
+#if defined(USE_SSE2_SCAN)
+#include <emmintrin.h>
+#endif
+
+#if defined(USE_GUARD_PAGES)
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #include <cstring>
+#include <cstdlib>
 #include <cmath>
+#include <new>
 #include <cctype>
 #include <string>
 #include <iostream>
 #include <sstream>
 #include <iomanip>
 #include <bitset>
+#include <algorithm>
+#include <vector>
 
 namespace bs {
 
@@ -15,12 +30,561 @@ namespace bs {
 	 * Constructs an array of bytes of the specified size
 	 * initialized with all zeroes.
 	 */
-	 Tape::Tape(std::size_t size) : m_size(size) {
-		m_cells = new unsigned char[m_size];
-		
-		memset(m_cells, 0, size);
+	 Tape::Tape(std::size_t size, TAPE_KIND kind) : m_size(size), m_kind(kind) {
+		//Growable tapes reserve everything now and let the pages get committed as they are touched
+		if(kind == TAPE_GROWABLE) {
+			m_size = GROWABLE_SIZE;
+			m_start = GROWABLE_SIZE / 2;
+		} else if(kind == TAPE_SPARSE) {
+			m_size = SPARSE_SIZE;
+			m_start = SPARSE_SIZE / 2;
+		}
+
+		allocate();
 	 }
 
+	//Copies the cells of the other tape, but not its snapshot
+	Tape::Tape(Tape const &other) : m_size(other.m_size), m_start(other.m_start), m_kind(other.m_kind) {
+		allocate();
+		copyCells(other);
+	}
+
+	//Takes the memory of the other tape, which is left empty
+	Tape::Tape(Tape &&other) noexcept : m_size(0), m_cells(nullptr) {
+		*this = std::move(other);
+	}
+
+	Tape& Tape::operator=(Tape const &other) {
+		if(this == &other)
+			return *this;
+
+		release();
+		m_size = other.m_size;
+		m_start = other.m_start;
+		m_kind = other.m_kind;
+		allocate();
+		copyCells(other);
+
+		return *this;
+	}
+
+	Tape& Tape::operator=(Tape &&other) noexcept {
+		if(this == &other)
+			return *this;
+
+		release();
+		outOfBounds = other.outOfBounds;
+		m_size = other.m_size;
+		m_start = other.m_start;
+		m_kind = other.m_kind;
+		m_cells = other.m_cells;
+		m_region = other.m_region;
+		m_regionSize = other.m_regionSize;
+		m_slack = other.m_slack;
+		m_directory = std::move(other.m_directory);
+		m_cachedPage = other.m_cachedPage;
+		m_cachedCells = other.m_cachedCells;
+		m_snapshot = other.m_snapshot;
+		m_savedDirectory = std::move(other.m_savedDirectory);
+		m_savedFile = other.m_savedFile;
+		m_savedCells = std::move(other.m_savedCells);
+
+		other.m_size = 0;
+		other.m_cells = nullptr;
+		other.m_region = nullptr;
+		other.m_regionSize = 0;
+		other.m_slack = 0;
+		other.m_cachedPage = SIZE_MAX;
+		other.m_cachedCells = nullptr;
+		other.m_snapshot = false;
+		other.m_savedFile = -1;
+
+		return *this;
+	}
+
+	//Copies the cells into this freshly allocated tape of the same kind, only the part the other tape used
+	void Tape::copyCells(Tape const &other) {
+		if(m_kind == TAPE_SPARSE) {
+			for(std::size_t index : other.touchedPages())
+				memcpy(&cell(index), other.findPage(index), PAGE_MASK + 1);
+
+			return;
+		}
+
+		std::size_t first, last;
+
+		if(other.usedRange(first, last))
+			memcpy(m_cells + first, other.m_cells + first, last - first);
+	}
+
+	/**
+	 * Allocates m_size zeroed cells. With guard pages the cells are mapped between GUARD_SIZE bytes
+	 * of inaccessible memory, so going off the tape faults instead of touching something else. The
+	 * first cell is right after the low guard, but the high guard only starts at the next page, so
+	 * going into the m_slack bytes before it isn't caught and has to be checked for.
+	 */
+	void Tape::allocate() {
+		//Sparse tapes make their pages when they're first touched
+		if(m_kind == TAPE_SPARSE) {
+			m_directory.resize(m_size >> (PAGE_BITS + TABLE_BITS));
+			m_cells = nullptr;
+			return;
+		}
+
+	#if defined(USE_GUARD_PAGES)
+		std::size_t page = sysconf(_SC_PAGESIZE);
+		std::size_t cells = (m_size + page - 1) / page * page;
+
+		m_regionSize = cells + 2 * GUARD_SIZE;
+		m_region = static_cast<unsigned char*>(mmap(nullptr, m_regionSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0));
+
+		if(m_region != MAP_FAILED && mprotect(m_region + GUARD_SIZE, cells, PROT_READ | PROT_WRITE) == 0) {
+			m_cells = m_region + GUARD_SIZE; //Fresh anonymous pages are already zeroed
+			m_slack = cells - m_size;
+			return;
+		}
+
+		if(m_region != MAP_FAILED)
+			munmap(m_region, m_regionSize);
+	#endif
+
+		//Without guard pages it's a plain zeroed array, calloc() gets large ones straight from the system so they're committed lazily too
+		m_regionSize = 0;
+		m_slack = 0;
+		m_region = static_cast<unsigned char*>(std::calloc(std::max<std::size_t>(m_size, 1), 1));
+
+		if(m_region == nullptr)
+			throw std::bad_alloc();
+
+		m_cells = m_region;
+	}
+
+	void Tape::release() {
+		m_directory.clear();
+		m_cachedPage = SIZE_MAX;
+		m_cachedCells = nullptr;
+		m_snapshot = false;
+		m_savedDirectory.clear();
+		std::vector<unsigned char>().swap(m_savedCells);
+
+	#if defined(USE_GUARD_PAGES)
+		if(m_savedFile >= 0) {
+			close(m_savedFile);
+			m_savedFile = -1;
+		}
+	#endif
+
+		if(m_region == nullptr)
+			return;
+
+	#if defined(USE_GUARD_PAGES)
+		if(m_regionSize != 0) {
+			munmap(m_region, m_regionSize);
+			m_region = nullptr;
+			return;
+		}
+	#endif
+
+		std::free(m_region);
+		m_region = nullptr;
+	}
+
+	/**
+	 * Saves the cells, so restore() can put them back later. This only costs as much as the pages written since the
+	 * last snapshot. Sparse tapes share their pages with the snapshot until they're written. Mapped tapes keep the
+	 * snapshot in a file that's mapped privately under the cells, so the kernel copies a page when it's first written.
+	 * Anything else is copied whole.
+	 */
+	void Tape::snapshot() {
+		m_snapshot = true;
+
+		if(m_kind == TAPE_SPARSE) {
+			m_savedDirectory = m_directory;
+			m_cachedPage = SIZE_MAX; //The cached page is shared now too
+			return;
+		}
+
+	#if defined(USE_GUARD_PAGES)
+		if(m_regionSize != 0 && saveDirtyPages()) {
+			if(!mapSnapshot())
+				throw std::bad_alloc(); //The cells aren't mapped anymore
+
+			return;
+		}
+	#endif
+
+		m_savedCells.assign(m_cells, m_cells + m_size);
+	}
+
+	/**
+	 * Puts the cells back to how they were at the last snapshot(), which can be restored again after.
+	 *
+	 * @return False if there's no snapshot.
+	 */
+	bool Tape::restore() {
+		if(!m_snapshot)
+			return false;
+
+		if(m_kind == TAPE_SPARSE) {
+			m_directory = m_savedDirectory;
+			m_cachedPage = SIZE_MAX;
+			return true;
+		}
+
+	#if defined(USE_GUARD_PAGES)
+		if(m_savedFile >= 0) {
+			if(!mapSnapshot())
+				throw std::bad_alloc();
+
+			return true;
+		}
+	#endif
+
+		memcpy(m_cells, m_savedCells.data(), m_size);
+		return true;
+	}
+
+#if defined(USE_GUARD_PAGES)
+	//Bits of the /proc/self/pagemap entries
+	const uint64_t PAGEMAP_PRESENT = uint64_t(1) << 63;
+	const uint64_t PAGEMAP_SWAPPED = uint64_t(1) << 62;
+	const uint64_t PAGEMAP_FILE = uint64_t(1) << 61;
+
+	/**
+	 * Writes the pages of the cells that aren't from the snapshot file into it, which are the ones written
+	 * since it was last mapped. The file is made on the first snapshot, and gets every page that isn't zero.
+	 *
+	 * @return False if there's no file, or the pages couldn't be found, in which case the cells have to be copied.
+	 */
+	bool Tape::saveDirtyPages() {
+		std::size_t page = sysconf(_SC_PAGESIZE);
+		unsigned char *start = m_region + GUARD_SIZE;
+		std::size_t length = m_regionSize - 2 * GUARD_SIZE;
+		bool fresh = m_savedFile < 0; //A new file is all zeroes already
+
+		if(fresh) {
+			m_savedFile = memfd_create("bs-tape", MFD_CLOEXEC);
+
+			if(m_savedFile >= 0 && ftruncate(m_savedFile, length) != 0) {
+				close(m_savedFile);
+				m_savedFile = -1;
+			}
+
+			if(m_savedFile < 0)
+				return false;
+		}
+
+		std::vector<uint64_t> entries(length / page);
+		std::size_t bytes = entries.size() * sizeof(uint64_t);
+		int pagemap = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+		bool found = pagemap >= 0 && pread(pagemap, entries.data(), bytes, reinterpret_cast<uintptr_t>(start) / page * sizeof(uint64_t)) == static_cast<ssize_t>(bytes);
+		bool saved = found;
+
+		if(pagemap >= 0)
+			close(pagemap);
+
+		for(std::size_t i = 0; saved && i < entries.size(); i++) {
+			unsigned char *data = start + i * page;
+
+			if(!(entries[i] & (PAGEMAP_PRESENT | PAGEMAP_SWAPPED)) || (entries[i] & PAGEMAP_FILE))
+				continue;
+
+			//Reading a page that was never written maps the shared zero page, which doesn't need saving
+			if(fresh && data[0] == 0 && memcmp(data, data + 1, page - 1) == 0)
+				continue;
+
+			saved = pwrite(m_savedFile, data, page, i * page) == static_cast<ssize_t>(page);
+		}
+
+		if(!saved) {
+			close(m_savedFile);
+			m_savedFile = -1;
+		}
+
+		return saved;
+	}
+
+	//Maps the snapshot file privately over the cells, which throws away every page written since
+	bool Tape::mapSnapshot() {
+		unsigned char *start = m_region + GUARD_SIZE;
+		std::size_t length = m_regionSize - 2 * GUARD_SIZE;
+
+		return mmap(start, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED | MAP_NORESERVE, m_savedFile, 0) == start;
+	}
+#endif
+
+	//Checks if an address is in one of the guards around the cells, which is where a fault from going off the tape lands
+	bool Tape::isGuard(const void *address) {
+		const unsigned char *byte = static_cast<const unsigned char*>(address);
+
+		if(m_regionSize == 0 || byte < m_region || byte >= m_region + m_regionSize)
+			return false;
+
+		return byte < m_region + GUARD_SIZE || byte >= m_region + m_regionSize - GUARD_SIZE;
+	}
+
+	/**
+	 * Finds the cells a growable tape has pages for, everything outside of them is still zero.
+	 * Fixed tapes are always used in full.
+	 *
+	 * @param last Set to one past the last used cell
+	 *
+	 * @return False if none of the cells have been touched.
+	 */
+	bool Tape::usedRange(std::size_t &first, std::size_t &last) const {
+		first = 0;
+		last = m_size;
+
+	#if defined(USE_GUARD_PAGES)
+		if(m_kind != TAPE_GROWABLE || m_regionSize == 0)
+			return true;
+
+		std::size_t page = sysconf(_SC_PAGESIZE);
+		unsigned char *start = m_region + GUARD_SIZE;
+		std::size_t length = m_regionSize - 2 * GUARD_SIZE;
+		std::vector<unsigned char> resident(length / page);
+
+		if(mincore(start, length, resident.data()) != 0)
+			return true;
+
+		std::size_t low = 0, high = resident.size();
+
+		while(low < high && !(resident[low] & 1))
+			low++;
+
+		while(high > low && !(resident[high - 1] & 1))
+			high--;
+
+		if(low == high)
+			return false;
+
+		first = low * page;
+		last = std::min(high * page, m_size);
+	#endif
+
+		return true;
+	}
+
+	//Finds the page of a sparse tape the cell is in, or null if it hasn't been touched, in which case it's all zeroes
+	unsigned char* Tape::findPage(std::size_t index) const {
+		const std::shared_ptr<Table> &table = m_directory[index >> (PAGE_BITS + TABLE_BITS)];
+
+		if(!table)
+			return nullptr;
+
+		return (*table)[(index >> PAGE_BITS) & (TABLE_SIZE - 1)].get();
+	}
+
+	//The first cell of every page a sparse tape has made, in order
+	std::vector<std::size_t> Tape::touchedPages() const {
+		std::vector<std::size_t> pages;
+
+		for(std::size_t table = 0; table < m_directory.size(); table++) {
+			if(!m_directory[table])
+				continue;
+
+			for(std::size_t page = 0; page < TABLE_SIZE; page++) {
+				if((*m_directory[table])[page])
+					pages.push_back((table << TABLE_BITS | page) << PAGE_BITS);
+			}
+		}
+
+		return pages;
+	}
+
+	/**
+	 * Makes the page the cell is in the one cell() uses, creating it and its table if they don't exist yet.
+	 * A page or table that's still shared with the snapshot gets copied first, since cell() can write to it.
+	 */
+	void Tape::cachePage(std::size_t index) {
+		std::shared_ptr<Table> &table = m_directory[index >> (PAGE_BITS + TABLE_BITS)];
+
+		if(!table)
+			table = std::make_shared<Table>(TABLE_SIZE);
+		else if(table.use_count() > 1)
+			table = std::make_shared<Table>(*table);
+
+		Page &page = (*table)[(index >> PAGE_BITS) & (TABLE_SIZE - 1)];
+
+		if(!page) {
+			page.reset(new unsigned char[PAGE_MASK + 1]());
+		} else if(page.use_count() > 1) {
+			Page copy(new unsigned char[PAGE_MASK + 1]);
+			memcpy(copy.get(), page.get(), PAGE_MASK + 1);
+			page = std::move(copy);
+		}
+
+		m_cachedPage = index >> PAGE_BITS;
+		m_cachedCells = page.get();
+	}
+
+	//Reads a cell without making a page for it
+	unsigned char Tape::peek(std::size_t index) {
+		if(m_cells != nullptr)
+			return m_cells[index];
+
+		unsigned char *page = findPage(index);
+
+		return page != nullptr ? page[index & PAGE_MASK] : 0;
+	}
+
+	//Checks if every cell is still zero, like when the tape was just made
+	bool Tape::isZero() {
+		std::size_t first, last;
+
+		if(m_kind == TAPE_SPARSE) {
+			for(std::size_t index : touchedPages()) {
+				unsigned char *page = findPage(index);
+
+				for(std::size_t i = 0; i <= PAGE_MASK; i++) {
+					if(page[i] != 0)
+						return false;
+				}
+			}
+
+			return true;
+		}
+
+		if(!usedRange(first, last))
+			return true;
+
+		for(std::size_t i = first; i < last; i++) {
+			if(m_cells[i] != 0)
+				return false;
+		}
+
+		return true;
+	}
+
+	/**
+	 * Finds the first zero cell going right from index in steps of stride,
+	 * which is what scan loops like [>] and [>>>>] do.
+	 *
+	 * @return The index of the zero cell, or the first index past the end of the tape if there isn't one.
+	 */
+	std::size_t Tape::scanRight(std::size_t index, std::size_t stride) {
+		if(index >= m_size)
+			return index;
+
+		if(m_cells == nullptr)
+			return scanSparse(index, stride, true);
+
+		if(stride == 1) {
+			void *zero = memchr(m_cells + index, 0, m_size - index);
+
+			return zero != nullptr ? static_cast<unsigned char*>(zero) - m_cells : m_size;
+		}
+
+	#if defined(USE_SSE2_SCAN)
+		//Strides that divide 16 land on the same bytes of every 16 byte block, so they can be masked
+		if(16 % stride == 0) {
+			const __m128i zero = _mm_setzero_si128();
+			int mask = 0;
+
+			for(std::size_t bit = 0; bit < 16; bit += stride)
+				mask |= 1 << bit;
+
+			while(index + 16 <= m_size) {
+				__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(m_cells + index));
+				int found = _mm_movemask_epi8(_mm_cmpeq_epi8(block, zero)) & mask;
+
+				if(found != 0)
+					return index + __builtin_ctz(found);
+
+				index += 16;
+			}
+		}
+	#endif
+
+		while(index < m_size && m_cells[index] != 0)
+			index += stride;
+
+		return index;
+	}
+
+	/**
+	 * Finds the first zero cell going left from index in steps of stride, for scan loops like [<].
+	 *
+	 * @return The index of the zero cell, or an index that wrapped around past the start of the tape if there isn't one.
+	 */
+	std::size_t Tape::scanLeft(std::size_t index, std::size_t stride) {
+		if(index >= m_size)
+			return index;
+
+		if(m_cells == nullptr)
+			return scanSparse(index, stride, false);
+
+	#if defined(__GLIBC__)
+		if(stride == 1) {
+			void *zero = memrchr(m_cells, 0, index + 1);
+
+			return zero != nullptr ? static_cast<unsigned char*>(zero) - m_cells : static_cast<std::size_t>(-1);
+		}
+	#endif
+
+	#if defined(USE_SSE2_SCAN)
+		//The blocks end at index instead of starting at it, so the mask starts from the top bit
+		if(16 % stride == 0) {
+			const __m128i zero = _mm_setzero_si128();
+			int mask = 0;
+
+			for(int bit = 15; bit >= 0; bit -= stride)
+				mask |= 1 << bit;
+
+			while(index >= 15) {
+				__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(m_cells + index - 15));
+				int found = _mm_movemask_epi8(_mm_cmpeq_epi8(block, zero)) & mask;
+
+				if(found != 0)
+					return index - 15 + (31 - __builtin_clz(found));
+
+				index -= 16;
+			}
+		}
+	#endif
+
+		while(index < m_size && m_cells[index] != 0)
+			index -= stride;
+
+		return index;
+	}
+
+	/**
+	 * Scans a sparse tape a page at a time, without making any pages. A page
+	 * that was never touched is all zeroes, so the scan stops as soon as it reaches one.
+	 *
+	 * @return The index of the zero cell, or an index off the tape like scanRight() and scanLeft() if there isn't one.
+	 */
+	std::size_t Tape::scanSparse(std::size_t index, std::size_t stride, bool right) {
+		while(index < m_size) {
+			unsigned char *page = findPage(index);
+			std::size_t first = index & ~PAGE_MASK;
+
+			if(page == nullptr)
+				return index;
+
+			if(right && stride == 1) {
+				void *zero = memchr(page + (index - first), 0, PAGE_MASK + 1 - (index - first));
+
+				if(zero != nullptr)
+					return first + (static_cast<unsigned char*>(zero) - page);
+
+				index = first + PAGE_MASK + 1;
+				continue;
+			}
+
+			//Going left past the start of the page wraps around, so this catches both ends
+			while(index - first <= PAGE_MASK) {
+				if(page[index - first] == 0)
+					return index;
+
+				index = right ? index + stride : index - stride;
+			}
+		}
+
+		return index;
+	}
+
 	//Helper function for fPrint, formats number
 	std::string formatChar(unsigned char num) {
 		int intNum = static_cast<int>(num);
@@ -42,7 +606,7 @@ namespace bs {
 	 *
 	 * @param cell Where to print in the tape, centered on that cell
 	 */
-	void Tape::fPrint(int cell) {
+	void Tape::fPrint(std::size_t cell) {
 		int arrowPos = 0;
 		int offSet = 0;
 		bool beginEllipsis, endEllipsis;
@@ -66,7 +630,7 @@ namespace bs {
 		offSet = endEllipsis ? offSet : 7 - (m_size - cell); //Makes sure the loop doesn't go past the size
 
 		for(int i = 0; i < 7; i++) {
-			std::string formatted = formatChar(m_cells[cell - offSet + i]);
+			std::string formatted = formatChar(peek(cell - offSet + i));
 			finalString += formatted + "|";
 		}
 
@@ -95,7 +659,7 @@ namespace bs {
 	}
 
 	//Helper function for fDump
-	int numDigits(int number) {
+	int numDigits(std::size_t number) {
 		std::string strNum = std::to_string(number);
 		return strNum.length();
 	}
@@ -128,7 +692,37 @@ namespace bs {
 
 		totalLines = std::ceil(m_size / valuesPerLine);
 		int digits = numDigits(m_size);
-		int currentLine = 0;
+		std::vector<std::pair<std::size_t, std::size_t>> ranges; //The lines to dump, everything in between is all zeroes
+
+		//Growable tapes only dump the part that was touched, and sparse tapes only the pages they have
+		if(m_kind == TAPE_GROWABLE) {
+			std::size_t first, last;
+
+			if(!usedRange(first, last)) {
+				first = m_start;
+				last = m_start + 1;
+			}
+
+			ranges.emplace_back(first / valuesPerLine, (last + valuesPerLine - 1) / valuesPerLine);
+		} else if(m_kind == TAPE_SPARSE) {
+			for(std::size_t page : touchedPages()) {
+				std::size_t first = page / valuesPerLine;
+				std::size_t last = (page + PAGE_MASK + valuesPerLine) / valuesPerLine;
+
+				//Lines can go over the end of a page, so the next one might start on the same line
+				if(!ranges.empty() && ranges.back().second >= first)
+					ranges.back().second = last;
+				else
+					ranges.emplace_back(first, last);
+			}
+
+			if(ranges.empty())
+				ranges.emplace_back(m_start / valuesPerLine, m_start / valuesPerLine + 1);
+		} else {
+			ranges.emplace_back(0, totalLines);
+		}
+
+		std::size_t currentLine = 0;
 
 		//Checking for duplicates
 		std::stringstream lastLine;
@@ -144,8 +738,10 @@ namespace bs {
 		currLine << std::setbase(base) << std::setfill('0');
 		std::cout << std::setfill('0');
 
-		for(std::size_t i = 0; i < totalLines; i++) {
-			
+		for(auto range : ranges)
+		for(std::size_t i = range.first; i < range.second; i++) {
+			currentLine = i * valuesPerLine;
+
 			//Beginning deliminattor
 			if(ascii)
 				asChar = " (";
@@ -154,7 +750,8 @@ namespace bs {
 				//Print the number for a certain base
 				std::string seperator = j == (valuesPerLine / 2) - 1 ? "  " : " ";
 
-				unsigned char value = m_cells[j + i * valuesPerLine];
+				std::size_t index = j + i * valuesPerLine;
+				unsigned char value = index < m_size ? peek(index) : 0;
 
 				//ASCII value printing or a period if not printable
 				if(ascii) {
@@ -199,14 +796,12 @@ namespace bs {
 				lastLine.swap(currLine);
 				currLine.str(std::string());
 			}
-
-			currentLine += valuesPerLine;
 		}
 
-		//CurrentLine has to be lowered because it's at the end
+		//CurrentLine is still the last line that was looked at
 		if(duplicate) {
 			std::cout << "*" << std::endl;
-			std::cout << std::setw(digits) << (currentLine -= valuesPerLine) << " : ";
+			std::cout << std::setw(digits) << currentLine << " : ";
 			if(ascii)
 					std::cout << endLine << asChar << std::endl;
 				else
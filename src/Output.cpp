@@ -0,0 +1,90 @@
+#include "config.hpp"
+#include "Output.hpp"
+
+#if defined(USE_MMAP)
+#include <cerrno>
+#include <unistd.h>
+#endif
+
+#include <cstring>
+
+namespace bs {
+
+	OutputWriter::OutputWriter(std::ostream &stream, std::size_t size) : m_stream(stream) {
+		setBufferSize(size);
+	}
+
+	OutputWriter::~OutputWriter() {
+		flush();
+	}
+
+	//The buffer is one byte bigger than the size, since it's written once it's full instead of once it goes over
+	void OutputWriter::setBufferSize(std::size_t size) {
+		if(!m_buffer.empty())
+			flush();
+
+		m_buffer.resize(size + 1);
+		m_next = m_buffer.data();
+		m_end = m_next + m_buffer.size();
+	}
+
+	void OutputWriter::setFile(int file) {
+		flush();
+		m_file = file;
+	}
+
+	//Adds a whole string, anything that doesn't fit in the buffer is written straight out
+	void OutputWriter::write(const char *string, std::size_t length) {
+		if(length < static_cast<std::size_t>(m_end - m_next)) {
+			memcpy(m_next, string, length);
+			m_next += length;
+			return;
+		}
+
+		flush();
+
+		if(length >= m_buffer.size()) {
+			writeOut(string, length);
+			return;
+		}
+
+		memcpy(m_next, string, length);
+		m_next += length;
+
+		if(m_next == m_end)
+			flush();
+	}
+
+	void OutputWriter::flush() {
+		if(m_next == m_buffer.data())
+			return;
+
+		writeOut(m_buffer.data(), m_next - m_buffer.data());
+		m_next = m_buffer.data();
+	}
+
+	void OutputWriter::writeOut(const char *string, std::size_t length) {
+	#if defined(USE_MMAP)
+		if(m_file >= 0) {
+			while(length > 0) {
+				ssize_t written = ::write(m_file, string, length);
+
+				if(written < 0 && errno == EINTR)
+					continue;
+
+				if(written <= 0)
+					return; //Nowhere to put it
+
+				string += written;
+				length -= written;
+			}
+
+			return;
+		}
+	#endif
+
+		m_stream.write(string, length);
+		m_stream.flush();
+	}
+
+}
@@ -0,0 +1,45 @@
+#include "PassManager.hpp"
+#include "Program.hpp"
+
+#include <chrono>
+
+namespace bs {
+
+	/**
+	 * Adds a pass to the end of the list.
+	 *
+	 * @param name What the pass is called in the stats
+	 */
+	void PassManager::add(const std::string &name, Pass pass) {
+		m_passes.push_back(std::make_pair(name, pass));
+	}
+
+	/**
+	 * Runs every pass on the blocks, the stats from the last run
+	 * replace the ones from before.
+	 */
+	void PassManager::run(std::vector<Block> &blocks) {
+		m_stats.clear();
+		m_stats.reserve(m_passes.size());
+
+		std::size_t tokens = countTokens(blocks);
+
+		for(auto &[name, pass] : m_passes) {
+			auto start = std::chrono::steady_clock::now();
+
+			pass(blocks);
+
+			auto end = std::chrono::steady_clock::now();
+			std::size_t after = countTokens(blocks);
+
+			m_stats.push_back(PassStats{name, std::chrono::duration<double, std::milli>(end - start).count(), tokens, after});
+			tokens = after;
+		}
+	}
+
+	//Removes all the passes, but not the stats
+	void PassManager::clear() {
+		m_passes.clear();
+	}
+
+}
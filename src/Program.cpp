@@ -1,5 +1,9 @@
 #include "Program.hpp"
 
+#include <algorithm>
+#include <map>
+#include <set>
+
 namespace bs {
 
 	/**
@@ -10,6 +14,8 @@ namespace bs {
 	 */
 	void Program::tokenize() {
 		tokens.clear();
+		tokens.reserve(source.length());
+		constants.clear();
 
 		for(size_t i = 0; i < source.length(); i++) {
 			tokens.push_back(Token{source[i], 1});
@@ -35,181 +41,801 @@ namespace bs {
 	}
 
 	/**
-	 * Takes in source code, then optionally optimizes it. And emits it as 
-	 * a Program class with the sort-of IR.
+	 * Counts the tokens in the blocks, with two for the brackets of each loop,
+	 * so it's the same as the length of the program once it's lowered.
 	 */
-	IREmitter::IREmitter(const char *source) {
-		m_source.source = source;
+	std::size_t countTokens(const std::vector<Block> &blocks) {
+		std::size_t count = 0;
+
+		for(const Block &block : blocks) {
+			if(block.kind == Block::BASIC) {
+				count += block.tokens.size();
+			} else {
+				count += countTokens(block.children) + 2;
+			}
+		}
+
+		return count;
 	}
 
-	/*
-	 * So the default constructor can be used,
+	/**
+	 * Flattens the blocks back into tokens. The brackets get their jump locations
+	 * straight from the tree, so they don't have to be found again with expr().
 	 */
-	void IREmitter::loadSource(const char *source) {
-		m_source.source = source;
+	void lowerBlocks(const std::vector<Block> &blocks, std::vector<Token> &tokens) {
+		for(const Block &block : blocks) {
+			if(block.kind == Block::BASIC) {
+				tokens.insert(tokens.end(), block.tokens.begin(), block.tokens.end());
+			} else {
+				std::size_t start = tokens.size();
+
+				tokens.push_back(Token{START_LOOP, 0});
+				lowerBlocks(block.children, tokens);
+
+				tokens[start].data = tokens.size();
+				tokens.push_back(Token{END_LOOP, static_cast<unsigned int>(start)});
+			}
+		}
+	}
+
+	//Drops empty basic blocks and joins basic blocks that ended up next to eachother after a loop between them was removed
+	void mergeBlocks(std::vector<Block> &blocks) {
+		std::vector<Block> newBlocks;
+		newBlocks.reserve(blocks.size());
+
+		for(Block &block : blocks) {
+			if(block.kind == Block::BASIC) {
+				if(block.tokens.empty())
+					continue;
+
+				if(!newBlocks.empty() && newBlocks.back().kind == Block::BASIC) {
+					std::vector<Token> &tokens = newBlocks.back().tokens;
+					tokens.insert(tokens.end(), block.tokens.begin(), block.tokens.end());
+					continue;
+				}
+			}
+
+			newBlocks.push_back(std::move(block));
+		}
+
+		blocks.swap(newBlocks);
 	}
 
 	/**
-	* This method will do the optimization like folding repetitive
-	* instructions into one and other creative things I can find
-	* or think of, without modifying the behavior.
-	* TODO: Split this method up
-	*/
-	void IREmitter::optimize(unsigned int level) {
+	 * Checks if the loop is a linear loop, one without I/O or nested loops that ends
+	 * on the cell it started on and changes that cell by exactly one.
+	 * Every pass adds a constant to each cell it touches, so the whole loop is the
+	 * same as adding a multiple of the first cell to each of them and clearing it.
+	 *
+	 * @param deltas Set to how much each cell, relative to the first, changes per pass
+	 */
+	bool isLinearLoop(const Block &loop, std::map<int, int> &deltas) {
+		int offset = 0;
+
+		deltas.clear();
+
+		//Anything but a single basic block has nested loops
+		if(loop.children.size() != 1 || loop.children[0].kind != Block::BASIC)
+			return false;
+
+		for(const Token &token : loop.children[0].tokens) {
+			switch(token.identifier) {
+				case SHIFT_RIGHT : offset += token.data;
+				break;
+				case SHIFT_LEFT : offset -= token.data;
+				break;
+				case INCREMENT : deltas[offset] += token.data;
+				break;
+				case DECREMENT : deltas[offset] -= token.data;
+				break;
+				default : return false; //I/O
+			}
+		}
+
+		int step = deltas[0] & 0xff;
+
+		return offset == 0 && (step == 1 || step == 255);
+	}
+
+	//Pushes a single shift token for the pointer movement that was put off, and resets it
+	void flushShift(std::vector<Token> &tokens, int &pending) {
+		if(pending > 0) {
+			tokens.push_back(Token{SHIFT_RIGHT, static_cast<unsigned int>(pending)});
+		} else if(pending < 0) {
+			tokens.push_back(Token{SHIFT_LEFT, static_cast<unsigned int>(-pending)});
+		}
+
+		pending = 0;
+	}
+
+	/**
+	 * Checks if the loop only moves the pointer in one direction, like [>] or [<<<<].
+	 * These are searching for a zero cell and can be done without going through the loop.
+	 *
+	 * @param direction Set to the shift the loop is made of
+	 * @param stride Set to how many cells the loop moves each time around
+	 */
+	bool isScanLoop(const Block &loop, char &direction, unsigned int &stride) {
+		if(loop.children.size() != 1 || loop.children[0].kind != Block::BASIC)
+			return false;
+
+		const std::vector<Token> &tokens = loop.children[0].tokens;
+
+		direction = tokens[0].identifier;
+		stride = 0;
+
+		if(direction != SHIFT_RIGHT && direction != SHIFT_LEFT)
+			return false;
+
+		for(const Token &token : tokens) {
+			if(token.identifier != direction)
+				return false;
+
+			stride += token.data;
+		}
+
+		return true;
+	}
+
+	//Remove all characters but <>-+,.[]
+	void stripComments(std::vector<Block> &blocks) {
+		for(Block &block : blocks) {
+			if(block.kind == Block::LOOP) {
+				stripComments(block.children);
+				continue;
+			}
+
+			std::vector<Token> newTokens;
+			newTokens.reserve(block.tokens.size());
+
+			for(const Token &token : block.tokens) {
+				char c = token.identifier;
+
+				if(c == SHIFT_LEFT || c == SHIFT_RIGHT || c == INCREMENT || c == DECREMENT || c == INPUT || c == OUTPUT) {
+					newTokens.push_back(token);
+				}
+			}
+
+			block.tokens.swap(newTokens);
+		}
+
+		mergeBlocks(blocks);
+	}
+
+	//Counts instructions and uses that as data for a single instruction, like run length encoding
+	void runLength(std::vector<Token> &tokens) {
 		std::vector<Token> newTokens;
 		std::size_t i = 0;
 
-		//Remove all characters but <>-+,.[]
-		for(std::size_t j = 0; j < m_source.tokens.size();) {
-			char c = m_source[j];
+		newTokens.reserve(tokens.size());
+
+		while(i < tokens.size()) {
+			char current = tokens[i].identifier;
+
+			if(current == SHIFT_LEFT || current == SHIFT_RIGHT ||
+			   current == INCREMENT  || current == DECREMENT) {
+				unsigned int sum = 0;
+
+				while(i < tokens.size() && tokens[i].identifier == current) {
+					sum += tokens[i].data;
+					i++;
+				}
 
-			if(c != SHIFT_LEFT && c != SHIFT_RIGHT && c != INCREMENT && c != DECREMENT &&
-			   c != START_LOOP && c != END_LOOP    && c != INPUT     && c != OUTPUT) {
-				m_source.tokens.erase(m_source.tokens.begin() + j);
+				newTokens.push_back(Token{current, sum});
 			} else {
-				j++;
+				//These are just whatever
+				newTokens.push_back(tokens[i]);
+				i++;
 			}
 		}
 
-		if(level < 1)
-			return;
+		tokens.swap(newTokens);
+	}
+
+	/**
+	 * Run length encodes the basic blocks and replaces the loops it can recognize
+	 * with tokens, which get appended to the basic block before them.
+	 */
+	void foldBlocks(std::vector<Block> &blocks) {
+		std::vector<Block> newBlocks;
+		std::map<int, int> deltas;
+		bool afterLoop = false; //The current cell is always zero right after a loop
+		char direction;
+		unsigned int stride;
+
+		newBlocks.reserve(blocks.size());
+
+		for(Block &block : blocks) {
+			if(block.kind == Block::BASIC) {
+				runLength(block.tokens);
+				newBlocks.push_back(std::move(block));
+				afterLoop = false;
+				continue;
+			}
 
-		//First Pass
-		while(i < m_source.tokens.size()) {
-			char current = m_source.tokens[i].identifier;
-			char previous = i > 0 ? m_source.tokens[i - 1].identifier : 0;
-			char next = i < m_source.tokens.size() - 1 ? m_source.tokens[i + 1].identifier : 0;
+			//Gets rid of loops that occur right after another loop
+			if(afterLoop)
+				continue;
 
-			if(current == SHIFT_LEFT || current == SHIFT_RIGHT ||
-			   current == INCREMENT  || current == DECREMENT) {
-				//Counts instructions and uses that as data for a single
-				//instruction, like run length encoding
+			afterLoop = true;
+
+			std::vector<Token> replacement;
 
-				unsigned int sum = 1;
-				char temp = next;
+			if(isLinearLoop(block, deltas)) {
+				//Clear loops and copy loops are just linear loops without or with other cells
+				int step = deltas[0] & 0xff;
 
-				while(temp == current && (sum + i) < m_source.tokens.size() - 1) {
-					sum++;
-					temp = m_source.tokens[i + sum].identifier;
+				for(const auto &[offset, delta] : deltas) {
+					if(offset == 0 || (delta & 0xff) == 0)
+						continue;
+
+					//A loop counting up runs 256 - n times, which is the same as multiplying by -n
+					unsigned int factor = (step == 1 ? -delta : delta) & 0xff;
+					replacement.push_back(Token{MULTIPLY, factor, offset});
 				}
 
-				newTokens.push_back(Token{current, sum});
+				replacement.push_back(Token{CLEAR, 1});
+			} else if(isScanLoop(block, direction, stride)) {
+				replacement.push_back(Token{direction == SHIFT_RIGHT ? SCAN_RIGHT : SCAN_LEFT, stride});
+			} else {
+				//Nothing special just a loop
+				foldBlocks(block.children);
+				newBlocks.push_back(std::move(block));
+				continue;
+			}
 
-				i += sum;
-			} else if(current == START_LOOP) {
-				
-				bool special = false; //Determines if a normal loop token should be pushed
+			if(newBlocks.empty() || newBlocks.back().kind != Block::BASIC)
+				newBlocks.push_back(Block{Block::BASIC});
 
-				//Check for very beginning of program
-				//These are usually for comments
-				if(i == 0) {
-					int count = 1;
+			std::vector<Token> &tokens = newBlocks.back().tokens;
+			tokens.insert(tokens.end(), replacement.begin(), replacement.end());
+		}
 
-					while(m_source.tokens[i + count].identifier != END_LOOP) {
-						count++;
-					}
+		blocks.swap(newBlocks);
+		mergeBlocks(blocks);
+	}
 
-					i += count + 1;
+	//First Pass
+	void foldLoops(std::vector<Block> &blocks) {
+		//A loop at the very beginning of the program never runs
+		//These are usually for comments
+		if(!blocks.empty() && blocks[0].kind == Block::LOOP)
+			blocks.erase(blocks.begin());
 
-					special = true;
-				} else if(next == INCREMENT) {
-					//Checks for the clear instruction
-					if(m_source.tokens[i + 2].identifier == END_LOOP) {
-						newTokens.push_back(Token{CLEAR, 1});
-						i += 3;
+		foldBlocks(blocks);
+	}
 
-						special = true;
-					}
-				} else if(next == DECREMENT) {
-					//Is it another clear instruction or is it a copy
-					if(m_source.tokens[i + 2].identifier == END_LOOP) {
-						newTokens.push_back(Token{CLEAR, 1});
-						i += 3;
+	//Second Pass
+	//Optimize for opposing operators +- ><, the new tokens are used like a stack so
+	//the tokens on either side of a pair that cancelled out get merged as well, like +><-
+	void cancelOpposing(std::vector<Block> &blocks) {
+		for(Block &block : blocks) {
+			if(block.kind == Block::LOOP) {
+				cancelOpposing(block.children);
+				continue;
+			}
+
+			std::vector<Token> newTokens;
+			newTokens.reserve(block.tokens.size());
 
-						special = true;
+			for(const Token &token : block.tokens) {
+				char current = token.identifier;
+				char previous = newTokens.empty() ? 0 : newTokens.back().identifier;
+
+				if(isOpposing(previous, current)) {
+					Token &top = newTokens.back();
+
+					if(top.data == token.data) {
+						//Remove both
+						newTokens.pop_back();
+					} else if(top.data > token.data) {
+						//Take away the seconds' data, from the firsts'
+						top.data -= token.data;
 					} else {
-						//Check for copy instruction, should be moved into the second pass later
-						std::string expected = ">+>+<<]"; //Sequence is [->+>+<<]
-						std::string actual;
-                                                                                                                        
-						for(std::size_t j = 0; j < 7; j++) {
-							actual += m_source.tokens[i + j + 2].identifier;
-						}	
-						
-						if(actual == expected) {
-							newTokens.push_back(Token{COPY, 1});
-							i += 9;
-
-							special = true;
-						}
-					}
-				} else if(previous == END_LOOP) {
-					//Gets rid of loops that occur right after another loop
-					char temp = next;
-					int count = 1;
-
-					while(temp != END_LOOP) {
-						count++;
-						temp = m_source.tokens[i + count].identifier;
+						//Take away the firsts' data, from the seconds', and replace it
+						top = Token{current, token.data - top.data};
 					}
+				} else if(current == previous && (current == SHIFT_LEFT || current == SHIFT_RIGHT ||
+				                                  current == INCREMENT  || current == DECREMENT)) {
+					//Left next to eachother after a pair in between them cancelled
+					newTokens.back().data += token.data;
+				} else {
+					newTokens.push_back(token);
+				}
+			}
 
-					i += count;
+			block.tokens.swap(newTokens);
+		}
 
-					special = true;
-				} 
-				
-				//Nothing special just a start loop
-				if(!special) {
-					newTokens.push_back(Token{current, 1});
-					i++;
+		mergeBlocks(blocks);
+	}
+
+	//Third Pass
+	//Folds pointer movement into the offsets of the tokens after it, the movement is only
+	//applied at the end of basic blocks and at linear loops, which need the pointer on their first cell
+	void foldOffsets(std::vector<Block> &blocks) {
+		for(Block &block : blocks) {
+			if(block.kind == Block::LOOP) {
+				foldOffsets(block.children);
+				continue;
+			}
+
+			std::vector<Token> newTokens;
+			int pending = 0;
+
+			newTokens.reserve(block.tokens.size());
+
+			for(const Token &token : block.tokens) {
+				switch(token.identifier) {
+					case SHIFT_RIGHT : pending += token.data;
+					break;
+					case SHIFT_LEFT : pending -= token.data;
+					break;
+					case INCREMENT : case DECREMENT : case INPUT : case OUTPUT : case CLEAR : case SET :
+						newTokens.push_back(Token{token.identifier, token.data, token.offset + pending});
+					break;
+					default :
+						flushShift(newTokens, pending);
+						newTokens.push_back(token);
+					break;
 				}
-			} else {
-				//These are just whatever
-				newTokens.push_back(Token{current, 1});
-				i++;
 			}
+
+			flushShift(newTokens, pending);
+
+			block.tokens.swap(newTokens);
 		}
+	}
 
-		//Replace the token lists in m_program
-		m_source.tokens.swap(newTokens);
-		newTokens.clear();
+	//How many tokens propagateConstants() runs before it gives up, so programs that never read input still compile
+	const std::size_t CONSTANT_BUDGET = 1000000;
 
-		i = 0;
+	//Cells past this are treated like they're off the tape, to keep the copy of the tape small
+	const std::size_t CONSTANT_CELLS = 1 << 20;
 
+	/**
+	 * The program state while it's being run at compile time. The tape starts out
+	 * zeroed and the pointer at the first cell, so everything is known until input.
+	 */
+	struct ConstantState {
+		//A cell that was changed, so it can be put back when a loop can't be finished
+		struct Change {
+			std::vector<unsigned char> *cells;
+			std::size_t index;
+			unsigned char value;
+		};
+
+		std::vector<unsigned char> cells;  //The values the program has given the cells
+		std::vector<unsigned char> stored; //The values the residue has stored in the cells at runtime
+		std::vector<Change> undo;
+		std::vector<Token> residue; //Tokens that still have to run, output and the stores it needs
+		std::size_t ptr = 0;
+		std::size_t steps = 0;
+		std::size_t highest = 0; //One past the highest cell that was touched
+
+		void write(std::vector<unsigned char> &target, std::size_t index, unsigned char value) {
+			undo.push_back(Change{&target, index, target[index]});
+			target[index] = value;
+
+			if(index >= highest)
+				highest = index + 1;
+		}
+
+		//Makes the cell at runtime hold what the program gave it
+		void store(std::size_t index) {
+			if(cells[index] != stored[index]) {
+				residue.push_back(Token{SET, cells[index], static_cast<int>(index)});
+				write(stored, index, cells[index]);
+			}
+		}
+	};
 
-		if(level < 2)
+	/**
+	 * Runs a single token on the state, without changing anything if it can't.
+	 *
+	 * @return False if the token reads input, touches a cell off the tape, or the budget ran out.
+	 */
+	bool evalToken(ConstantState &state, const Token &token) {
+		std::size_t size = state.cells.size();
+		std::size_t cell = state.ptr + token.offset; //Negative cells wrap around to huge values
+
+		if(++state.steps > CONSTANT_BUDGET)
+			return false;
+
+		switch(token.identifier) {
+			case SHIFT_RIGHT :
+				if(state.ptr + token.data >= size) return false;
+				state.ptr += token.data;
+			break;
+			case SHIFT_LEFT :
+				if(token.data > state.ptr) return false;
+				state.ptr -= token.data;
+			break;
+			case INCREMENT :
+				if(cell >= size) return false;
+				state.write(state.cells, cell, state.cells[cell] + token.data);
+			break;
+			case DECREMENT :
+				if(cell >= size) return false;
+				state.write(state.cells, cell, state.cells[cell] - token.data);
+			break;
+			case CLEAR : case SET :
+				if(cell >= size) return false;
+				state.write(state.cells, cell, token.identifier == SET ? token.data : 0);
+			break;
+			case MULTIPLY :
+				if(cell >= size) return false;
+				state.write(state.cells, cell, state.cells[cell] + state.cells[state.ptr] * token.data);
+			break;
+			case SCAN_RIGHT : case SCAN_LEFT : {
+				std::size_t index = state.ptr;
+
+				while(state.cells[index] != 0) {
+					index = token.identifier == SCAN_RIGHT ? index + token.data : index - token.data;
+
+					if(index >= size || ++state.steps > CONSTANT_BUDGET)
+						return false;
+				}
+
+				state.ptr = index;
+			}
+			break;
+			case OUTPUT :
+				if(cell >= size) return false;
+				state.store(cell);
+				state.residue.push_back(Token{OUTPUT, 1, static_cast<int>(cell)});
+			break;
+			case INPUT : return false;
+		}
+
+		return true;
+	}
+
+	bool evalBlocks(ConstantState &state, const std::vector<Block> &blocks);
+
+	//Runs the loop until the current cell is zero
+	bool evalLoop(ConstantState &state, const Block &loop) {
+		while(state.cells[state.ptr] != 0) {
+			if(++state.steps > CONSTANT_BUDGET || !evalBlocks(state, loop.children))
+				return false;
+		}
+
+		return true;
+	}
+
+	bool evalBlocks(ConstantState &state, const std::vector<Block> &blocks) {
+		for(const Block &block : blocks) {
+			if(block.kind == Block::LOOP) {
+				if(!evalLoop(state, block))
+					return false;
+
+				continue;
+			}
+
+			for(const Token &token : block.tokens) {
+				if(!evalToken(state, token))
+					return false;
+			}
+		}
+
+		return true;
+	}
+
+	/**
+	 * Runs the start of the program at compile time, while the cells and pointer are known.
+	 * What it ran is replaced by stores of the final cell values and a shift to the final
+	 * pointer, with any output kept in order. Loops that never run disappear and loops that
+	 * do are unrolled completely. It stops at input, or a loop it can't finish within the budget.
+	 *
+	 * @param tapeSize Size of the zeroed tape the program starts on, or 0 if it doesn't
+	 */
+	void propagateConstants(std::vector<Block> &blocks, std::size_t tapeSize) {
+		ConstantState state;
+		std::size_t i = 0;
+		std::size_t stop = 0; //Token in blocks[i] it stopped at
+
+		if(tapeSize == 0)
 			return;
 
-		//Second Pass
-		while(i < m_source.tokens.size()) {
-			char current = m_source.tokens[i].identifier;
-			char next = i < m_source.tokens.size() - 1 ? m_source.tokens[i + 1].identifier : 0;
+		state.cells.assign(std::min(tapeSize, CONSTANT_CELLS), 0);
+		state.stored.assign(state.cells.size(), 0);
 
-			//Optimize for opposing operators +- ><
-			if(current == SHIFT_LEFT || current == SHIFT_RIGHT ||
-			   current == INCREMENT  || current == DECREMENT) {
-				
-				if(isOpposing(current, next)) {
-					if(m_source.tokens[i].data == m_source.tokens[i + 1].data) {
-						//Remove both
-						m_source.tokens.erase(m_source.tokens.begin() + i);
-						m_source.tokens.erase(m_source.tokens.begin() + i);
-					} else if(m_source.tokens[i].data > m_source.tokens[i + 1].data) {
-						//Take away the seconds' data, from the firsts', and then remove it
-						m_source.tokens[i].data -= m_source.tokens[i + 1].data;
-						m_source.tokens.erase(m_source.tokens.begin() + i + 1);
-						i++;
-					} else {
-						//Take away the firsts' data, from the seconds', then remove it
-						m_source.tokens[i + 1].data -= m_source.tokens[i].data;
-						m_source.tokens.erase(m_source.tokens.begin() + i);
-						i++;
+		for(; i < blocks.size(); i++) {
+			std::vector<Token> &tokens = blocks[i].tokens;
+
+			if(blocks[i].kind == Block::BASIC) {
+				for(stop = 0; stop < tokens.size(); stop++) {
+					if(!evalToken(state, tokens[stop]))
+						break;
+				}
+
+				if(stop < tokens.size())
+					break;
+
+				continue;
+			}
+
+			std::size_t ptr = state.ptr;
+			std::size_t residue = state.residue.size();
+
+			state.undo.clear();
+			stop = 0;
+
+			if(!evalLoop(state, blocks[i])) {
+				//Put everything back to how it was before the loop
+				for(auto change = state.undo.rbegin(); change != state.undo.rend(); change++)
+					(*change->cells)[change->index] = change->value;
+
+				state.ptr = ptr;
+				state.residue.resize(residue);
+				break;
+			}
+		}
+
+		//Nothing could be run
+		if(i == 0 && stop == 0)
+			return;
+
+		for(std::size_t cell = 0; cell < state.highest; cell++)
+			state.store(cell);
+
+		if(state.ptr > 0)
+			state.residue.push_back(Token{SHIFT_RIGHT, static_cast<unsigned int>(state.ptr)});
+
+		std::vector<Block> newBlocks;
+		newBlocks.push_back(Block{Block::BASIC, std::move(state.residue)});
+
+		//The rest of the block it stopped in still has to run
+		if(i < blocks.size() && blocks[i].kind == Block::BASIC) {
+			std::vector<Token> &tokens = newBlocks.back().tokens;
+			tokens.insert(tokens.end(), blocks[i].tokens.begin() + stop, blocks[i].tokens.end());
+			i++;
+		}
+
+		for(; i < blocks.size(); i++)
+			newBlocks.push_back(std::move(blocks[i]));
+
+		blocks.swap(newBlocks);
+		mergeBlocks(blocks);
+	}
+
+	/**
+	 * Removes stores to cells that get written again later in the same block, before anything reads them.
+	 * Goes backwards so every store is checked against the ones after it.
+	 */
+	void removeDeadStores(std::vector<Token> &tokens) {
+		std::vector<Token> newTokens;
+		std::set<int> overwritten; //Cells that are written before they're read, relative to the current pointer
+		int pos = 0;
+
+		newTokens.reserve(tokens.size());
+
+		for(auto token = tokens.rbegin(); token != tokens.rend(); token++) {
+			int cell = pos + token->offset;
+
+			switch(token->identifier) {
+				case SHIFT_RIGHT : pos -= token->data;
+				break;
+				case SHIFT_LEFT : pos += token->data;
+				break;
+				case SET : case CLEAR : case INCREMENT : case DECREMENT :
+					if(overwritten.count(cell))
+						continue;
+
+					//Increments and decrements read the cell too
+					if(token->identifier == SET || token->identifier == CLEAR)
+						overwritten.insert(cell);
+				break;
+				case MULTIPLY :
+					if(overwritten.count(cell))
+						continue;
+
+					overwritten.erase(pos);
+				break;
+				case INPUT :
+					//Once the input ends the cell can keep what it had, so the stores before it aren't dead
+					overwritten.erase(cell);
+				break;
+				case OUTPUT : overwritten.erase(cell);
+				break;
+				case PRINT :
+					//A store before the print could be the one that errors, so it has to stay before it
+					overwritten.clear();
+				break;
+				case SCAN_RIGHT : case SCAN_LEFT :
+					//Where the pointer was before is unknown, and any cell could have been read
+					overwritten.clear();
+					pos = 0;
+				break;
+			}
+
+			newTokens.push_back(*token);
+		}
+
+		tokens.assign(newTokens.rbegin(), newTokens.rend());
+	}
+
+	/**
+	 * Replaces outputs of cells with known values by PRINT tokens, joining the ones that only have
+	 * arithmetic between them into a single string. Values are only followed inside of a basic block,
+	 * from the constant stores in it. The stores that were only there for the output are removed after.
+	 * The bytes are printed before the first access to a cell that isn't known yet, since it could be
+	 * out of bounds, and whatever came out before the error has to be printed.
+	 *
+	 * @param constants Where the printed bytes go
+	 */
+	void coalesceOutput(std::vector<Block> &blocks, std::string &constants) {
+		for(Block &block : blocks) {
+			if(block.kind == Block::LOOP) {
+				coalesceOutput(block.children, constants);
+				continue;
+			}
+
+			std::vector<Token> newTokens;
+			std::map<int, unsigned char> known; //Cells relative to the pointer at the start of the block
+			std::size_t start = constants.size(); //Start of the string being built
+			int pos = 0;
+			bool printed = false;
+
+			auto flushPrint = [&]() {
+				if(constants.size() > start)
+					newTokens.push_back(Token{PRINT, static_cast<unsigned int>(constants.size() - start), static_cast<int>(start)});
+
+				start = constants.size();
+			};
+
+			newTokens.reserve(block.tokens.size());
+
+			for(const Token &token : block.tokens) {
+				int cell = pos + token.offset;
+				auto value = known.find(cell);
+
+				switch(token.identifier) {
+					case SHIFT_RIGHT : pos += token.data;
+					break;
+					case SHIFT_LEFT : pos -= token.data;
+					break;
+					case INCREMENT :
+						if(value != known.end())
+							value->second += token.data;
+						else
+							flushPrint();
+					break;
+					case DECREMENT :
+						if(value != known.end())
+							value->second -= token.data;
+						else
+							flushPrint();
+					break;
+					case CLEAR : case SET :
+						if(value == known.end())
+							flushPrint();
+
+						known[cell] = token.identifier == SET ? token.data : 0;
+					break;
+					case MULTIPLY : {
+						auto factor = known.find(pos);
+
+						if(value != known.end() && factor != known.end()) {
+							value->second += factor->second * token.data;
+						} else {
+							flushPrint();
+							known.erase(cell);
+						}
 					}
-				} else {
-					i++;
+					break;
+					case SCAN_RIGHT : case SCAN_LEFT :
+						flushPrint();
+						known.clear();
+						pos = 0;
+					break;
+					case INPUT :
+						flushPrint();
+						known.erase(cell);
+					break;
+					case OUTPUT :
+						if(value != known.end()) {
+							constants += static_cast<char>(value->second);
+							printed = true;
+							continue;
+						}
+
+						flushPrint();
+					break;
 				}
+
+				newTokens.push_back(token);
+			}
+
+			flushPrint();
+
+			if(printed)
+				removeDeadStores(newTokens);
+
+			block.tokens.swap(newTokens);
+		}
+	}
+
+	/**
+	 * Takes in source code, then optionally optimizes it. And emits it as 
+	 * a Program class with the sort-of IR.
+	 */
+	IREmitter::IREmitter(const char *source) {
+		m_source.source = source;
+	}
+
+	/*
+	 * So the default constructor can be used,
+	 */
+	void IREmitter::loadSource(const char *source) {
+		m_source.source = source;
+	}
+
+	/**
+	 * Loads tokens that were already optimized, like from a ProgramCache,
+	 * instead of tokenizing and optimizing the source.
+	 */
+	void IREmitter::loadTokens(const Token *tokens, std::size_t count, const char *constants, std::size_t length) {
+		m_source.tokens.assign(tokens, tokens + count);
+		m_source.constants.assign(constants, length);
+		m_source.processed = true;
+		m_passes = PassManager();
+
+		buildTree();
+	}
+
+	/**
+	* This method will do the optimization like folding repetitive
+	* instructions into one and other creative things I can find
+	* or think of, without modifying the behavior.
+	* The passes for the level are run over the loop tree built by expr(),
+	* which is then lowered back into the tokens.
+	*
+	* @param knownTape Size of the tape if the program starts on the first cell of a zeroed one, or 0
+	*/
+	void IREmitter::optimize(unsigned int level, std::size_t knownTape) {
+		m_passes.clear();
+		m_passes.add("strip-comments", stripComments);
+
+		if(level >= 1)
+			m_passes.add("fold-loops", foldLoops);
+
+		if(level >= 2) {
+			m_passes.add("cancel-opposing", cancelOpposing);
+			m_passes.add("propagate-constants", [knownTape](std::vector<Block> &blocks) { propagateConstants(blocks, knownTape); });
+			m_passes.add("fold-offsets", foldOffsets);
+			m_passes.add("coalesce-output", [this](std::vector<Block> &blocks) { coalesceOutput(blocks, m_source.constants); });
+		}
+
+		m_passes.run(m_tree);
+
+		m_source.tokens.clear();
+		m_source.tokens.reserve(countTokens(m_tree));
+		lowerBlocks(m_tree, m_source.tokens);
+	}
+
+	/**
+	 * Builds the loop tree from the tokens, everything between two brackets
+	 * goes into one basic block. The brackets have to be valid already.
+	 */
+	void IREmitter::buildTree() {
+		std::vector<std::vector<Block>*> openLoops = {&m_tree};
+
+		m_tree.clear();
+
+		for(const Token &token : m_source.tokens) {
+			std::vector<Block> &current = *openLoops.back();
+
+			if(token.identifier == START_LOOP) {
+				current.push_back(Block{Block::LOOP});
+				openLoops.push_back(&current.back().children);
+			} else if(token.identifier == END_LOOP) {
+				openLoops.pop_back();
 			} else {
-				i++;
+				if(current.empty() || current.back().kind != Block::BASIC)
+					current.push_back(Block{Block::BASIC});
+
+				current.back().tokens.push_back(token);
 			}
 		}
 	}
@@ -217,6 +843,7 @@ namespace bs {
 	/**
 	* This method is responsible for putting certain data into tokens
 	* and validation check, for [ and ] it can put jump information.
+	* A valid program also gets built into the loop tree for optimize().
 	*
 	* @return Whether or not m_program has valid syntax.
 	*/
@@ -242,10 +869,14 @@ namespace bs {
 			}
 		}
 
-		if(!openLoops.empty())
+		if(!openLoops.empty()) {
 			m_error = "Too many '[' for closed loops ']'";
+			return false;
+		}
+
+		buildTree();
 
-		return openLoops.empty();
+		return true;
 	}
 
 	//Just does the tokenize method
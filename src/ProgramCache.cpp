@@ -0,0 +1,216 @@
+#include "config.hpp"
+#include "ProgramCache.hpp"
+
+#if defined(USE_MMAP)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <vector>
+
+namespace bs {
+
+	uint64_t hashBytes(const void *data, std::size_t length, uint64_t hash) {
+		const unsigned char *bytes = static_cast<const unsigned char*>(data);
+
+		for(std::size_t i = 0; i < length; i++) {
+			hash ^= bytes[i];
+			hash *= 0x100000001b3;
+		}
+
+		return hash;
+	}
+
+	/**
+	 * Checks the tokens from a cache file are a program the optimizer could have made, so a
+	 * damaged file can't send the interpreters off the constants or to a bracket that isn't there.
+	 * Every token has to be a known instruction, the brackets have to match and point at eachother,
+	 * the tokens that only move the pointer can't have an offset, and prints have to stay in the constants.
+	 */
+	bool validTokens(const Token *tokens, std::size_t count, std::size_t constantsLength) {
+		std::vector<std::size_t> openLoops;
+
+		for(std::size_t i = 0; i < count; i++) {
+			const Token &token = tokens[i];
+
+			switch(token.identifier) {
+				case INCREMENT : case DECREMENT : case INPUT : case OUTPUT : case CLEAR : case SET : case MULTIPLY :
+				break;
+				case SHIFT_RIGHT : case SHIFT_LEFT :
+					if(token.offset != 0) return false;
+				break;
+				case SCAN_RIGHT : case SCAN_LEFT :
+					if(token.offset != 0 || token.data == 0) return false;
+				break;
+				case START_LOOP :
+					if(token.offset != 0) return false;
+					openLoops.push_back(i);
+				break;
+				case END_LOOP :
+					if(token.offset != 0 || openLoops.empty() || token.data != openLoops.back() || tokens[openLoops.back()].data != i)
+						return false;
+					openLoops.pop_back();
+				break;
+				case PRINT :
+					if(token.offset < 0 || static_cast<std::size_t>(token.offset) > constantsLength || token.data > constantsLength - token.offset)
+						return false;
+				break;
+				default : return false;
+			}
+		}
+
+		return openLoops.empty();
+	}
+
+	/**
+	 * @param directory Where the files go, an empty string turns the cache off
+	 */
+	ProgramCache::ProgramCache(const std::string &directory) : m_directory(directory) { }
+
+	//Fills in everything but the sizes of the program
+	ProgramCache::Header ProgramCache::makeHeader(const std::string &source, unsigned int level, std::size_t knownTape) {
+		Header header;
+
+		std::memset(&header, 0, sizeof(Header));
+		std::memcpy(header.magic, "BSIR", 4);
+		header.version = VERSION;
+		header.sourceHash = hashBytes(source.data(), source.size());
+		header.sourceLength = source.size();
+		header.knownTape = knownTape;
+		header.level = level;
+		header.tokenSize = sizeof(Token);
+
+		return header;
+	}
+
+	//The file name has everything the optimized program depends on in it
+	std::string ProgramCache::path(const Header &header) {
+		std::stringstream name;
+
+		name << std::hex << hashBytes(&header, sizeof(Header)) << ".bsir";
+
+		return (std::filesystem::path(m_directory) / name.str()).string();
+	}
+
+	/**
+	 * Looks for the optimized form of the source loaded in the emitter, and gives it to
+	 * the emitter if it's there. The tokens are read straight out of the mapped file.
+	 * A file with tokens that don't make a valid program is treated as a miss, so it gets optimized again.
+	 *
+	 * @return True if the emitter now has the optimized program.
+	 */
+	bool ProgramCache::load(IREmitter &emitter, unsigned int level, std::size_t knownTape) {
+		if(!enabled())
+			return false;
+
+		Header expected = makeHeader(emitter.getSource(), level, knownTape);
+		std::string file = path(expected);
+		std::size_t size;
+		const char *data;
+
+	#if defined(USE_MMAP)
+		int fd = open(file.c_str(), O_RDONLY);
+		struct stat info;
+
+		if(fd < 0)
+			return false;
+
+		if(fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) < sizeof(Header)) {
+			close(fd);
+			return false;
+		}
+
+		size = info.st_size;
+		void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+
+		if(map == MAP_FAILED)
+			return false;
+
+		data = static_cast<const char*>(map);
+	#else
+		std::ifstream stream(file, std::ios::binary);
+
+		if(!stream.good())
+			return false;
+
+		std::vector<char> contents((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+		size = contents.size();
+		data = contents.data();
+
+		if(size < sizeof(Header))
+			return false;
+	#endif
+
+		Header header;
+		std::memcpy(&header, data, sizeof(Header));
+
+		//Everything but the sizes has to be the same, and the sizes have to add up to the file
+		bool valid = std::memcmp(&header, &expected, offsetof(Header, tokenCount)) == 0 &&
+		             header.tokenCount <= (size - sizeof(Header)) / sizeof(Token) &&
+		             sizeof(Header) + header.tokenCount * sizeof(Token) + header.constantsLength == size;
+
+		if(valid) {
+			const Token *tokens = reinterpret_cast<const Token*>(data + sizeof(Header));
+			const char *constants = data + sizeof(Header) + header.tokenCount * sizeof(Token);
+
+			valid = validTokens(tokens, header.tokenCount, header.constantsLength);
+
+			if(valid)
+				emitter.loadTokens(tokens, header.tokenCount, constants, header.constantsLength);
+		}
+
+	#if defined(USE_MMAP)
+		munmap(const_cast<char*>(data), size);
+	#endif
+
+		return valid;
+	}
+
+	/**
+	 * Writes the optimized program in the emitter to the cache. It goes to a temporary
+	 * file first and gets renamed, so nothing ever sees half of a file.
+	 *
+	 * @return True if it was written.
+	 */
+	bool ProgramCache::store(IREmitter &emitter, unsigned int level, std::size_t knownTape) {
+		if(!enabled())
+			return false;
+
+		Program program = emitter.emit();
+		Header header = makeHeader(program.source, level, knownTape);
+		std::string file = path(header);
+		std::string temp = file + "." + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+		std::error_code error;
+
+		header.tokenCount = program.tokens.size();
+		header.constantsLength = program.constants.size();
+
+		std::filesystem::create_directories(m_directory, error);
+
+		std::ofstream stream(temp, std::ios::binary);
+
+		stream.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+		stream.write(reinterpret_cast<const char*>(program.tokens.data()), program.tokens.size() * sizeof(Token));
+		stream.write(program.constants.data(), program.constants.size());
+		stream.close();
+
+		if(!stream.good() || std::rename(temp.c_str(), file.c_str()) != 0) {
+			std::remove(temp.c_str());
+			return false;
+		}
+
+		return true;
+	}
+
+}
@@ -0,0 +1,323 @@
+#include "config.hpp"
+#include "ThreadedInterpreter.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+namespace bs {
+
+	//Cells for the dispatch loops on a sparse tape, which doesn't have a single block of memory to index into
+	struct SparseCells {
+		Tape &tape;
+
+		inline unsigned char& operator[](std::size_t index) { return tape.cell(index); }
+	};
+
+	ThreadedInterpreter::ThreadedInterpreter(std::ostream &stream, bool numInput, std::size_t memSize, TAPE_KIND tape) : Interpreter(stream, numInput, memSize, tape), m_pc(0) { }
+
+	ThreadedInterpreter::~ThreadedInterpreter() { }
+
+	/**
+	 * Unprocessed programs are still tokenized so they can be decoded, they just
+	 * aren't optimized, which keeps the token indices the same as the character indices.
+	 * Their brackets aren't checked either, one without a match is only an error once it's reached.
+	 */
+	bool ThreadedInterpreter::loadProgram(const char *program, bool process, bool resetDataPtr, unsigned int optimization) {
+		m_emitter.loadSource(program);
+
+		m_instPtr = 0;
+
+		if(resetDataPtr)
+			m_dataPtr = m_memory.m_start;
+
+		if(process) {
+			if(!processProgram(optimization, resetDataPtr))
+				return false;
+		} else {
+			m_emitter.tokenize();
+		}
+
+		m_program = m_emitter.emit();
+
+		if(process)
+			preRun();
+
+		if(!decode(m_program, m_code, m_origin, m_error, !process))
+			return false;
+
+		//Start from the instruction preRun() stopped at, skipping comments before it
+		m_pc = std::lower_bound(m_origin.begin(), m_origin.end(), m_instPtr) - m_origin.begin();
+
+		return true;
+	}
+
+	//Saves the state at the faulting instruction and builds the same message as the BasicInterpreter
+	bool ThreadedInterpreter::memoryError(std::size_t pc, std::size_t dataPtr) {
+		m_pc = pc;
+		m_instPtr = m_origin[pc];
+		m_dataPtr = dataPtr;
+
+		m_error = "Out-of-Bounds memory access on instruction '";
+		m_error += m_program.tokens[m_instPtr].identifier;
+		m_error += "' at character ";
+		m_error += std::to_string(m_instPtr + 1);
+
+		return false;
+	}
+
+	//Saves the state at the bracket and builds the same message as the BasicInterpreter
+	bool ThreadedInterpreter::unmatchedError(std::size_t pc, std::size_t dataPtr) {
+		m_pc = pc;
+		m_instPtr = m_origin[pc];
+		m_dataPtr = dataPtr;
+
+		m_error = m_code[pc].data == START_LOOP ? "No matching bracket ] for instruction '" : "No matching bracket [ for instruction '";
+		m_error += static_cast<char>(m_code[pc].data);
+		m_error += "' at character ";
+		m_error += std::to_string(m_instPtr + 1);
+
+		return false;
+	}
+
+	/**
+	 * The computed goto loop, every handler jumps straight to the next handler
+	 * through the opcode table instead of going back through a switch. The interpreter state is kept in
+	 * locals and only written back when execution stops.
+	 *
+	 * @param cells The tape's cells, or SparseCells for a sparse tape
+	 *
+	 * @return True if the program ran to the end without an error.
+	 */
+	template<typename Cells>
+	bool ThreadedInterpreter::dispatchThreaded(Cells cells) {
+	#if defined(USE_COMPUTED_GOTO)
+		static const void *handlers[OP_COUNT] = {
+			&&shift_right, &&shift_left, &&increment, &&decrement, &&start_loop,
+			&&end_loop, &&input, &&output, &&print, &&clear, &&set, &&multiply, &&scan_right,
+			&&scan_left, &&unmatched, &&halt
+		};
+
+		const Instruction *code = m_code.data();
+		const Instruction *ip = code + m_pc;
+		const std::size_t size = m_memory.m_size;
+		const char *constants = m_program.constants.data();
+		std::size_t dp = m_dataPtr;
+
+		#define DISPATCH() goto *handlers[ip->op]
+		#define NEXT() ip++; DISPATCH()
+		#define CHECK(cell) if((cell) >= size) return memoryError(ip - code, dp) //Negative cells wrap around to huge values
+		#define OUTPUT_CHECK(cell) if((cell) >= size) { putChar(m_memory.m_dummy); return memoryError(ip - code, dp); } //The BasicInterpreter prints its dummy cell before the error
+
+		DISPATCH();
+
+		shift_right : dp += ip->data;
+		NEXT();
+		shift_left : dp -= ip->data;
+		NEXT();
+		increment : CHECK(dp + ip->offset); cells[dp + ip->offset] += ip->data;
+		NEXT();
+		decrement : CHECK(dp + ip->offset); cells[dp + ip->offset] -= ip->data;
+		NEXT();
+		start_loop : CHECK(dp); if(cells[dp] == 0) ip = code + ip->data;
+		NEXT();
+		end_loop : CHECK(dp); if(cells[dp] != 0) ip = code + ip->data;
+		NEXT();
+		input : CHECK(dp + ip->offset); cells[dp + ip->offset] = getChar(cells[dp + ip->offset]);
+		NEXT();
+		output : OUTPUT_CHECK(dp + ip->offset); putChar(cells[dp + ip->offset]);
+		NEXT();
+		print : putString(constants + ip->data, ip->offset);
+		NEXT();
+		clear : CHECK(dp + ip->offset); cells[dp + ip->offset] = 0;
+		NEXT();
+		set : CHECK(dp + ip->offset); cells[dp + ip->offset] = ip->data;
+		NEXT();
+		multiply : CHECK(dp);
+			if(cells[dp] != 0) {
+				CHECK(dp + ip->offset);
+				cells[dp + ip->offset] += cells[dp] * ip->data;
+			}
+		NEXT();
+		scan_right : dp = m_memory.scanRight(dp, ip->data); CHECK(dp);
+		NEXT();
+		scan_left : dp = m_memory.scanLeft(dp, ip->data); CHECK(dp);
+		NEXT();
+		unmatched : //An open bracket only has to jump when the cell is zero
+			if(ip->data == START_LOOP) {
+				CHECK(dp);
+				if(cells[dp] != 0) { NEXT(); }
+			}
+
+			return unmatchedError(ip - code, dp);
+		halt :
+			m_pc = ip - code;
+			m_instPtr = m_origin[m_pc];
+			m_dataPtr = dp;
+
+			return true;
+
+		#undef DISPATCH
+		#undef NEXT
+		#undef CHECK
+		#undef OUTPUT_CHECK
+	#else
+		return dispatchSwitch(cells, false);
+	#endif
+	}
+
+	/**
+	 * The portable dispatch loop, used for stepping and when computed goto isn't available.
+	 *
+	 * @param cells The tape's cells, or SparseCells for a sparse tape
+	 * @param single Whether to stop after one instruction.
+	 *
+	 * @return True if the instructions were executed successfully.
+	 */
+	template<typename Cells>
+	bool ThreadedInterpreter::dispatchSwitch(Cells cells, bool single) {
+		const Instruction *code = m_code.data();
+		const Instruction *ip = code + m_pc;
+		const std::size_t size = m_memory.m_size;
+		const char *constants = m_program.constants.data();
+		std::size_t dp = m_dataPtr;
+
+		#define CHECK(cell) if((cell) >= size) return memoryError(ip - code, dp)
+		#define OUTPUT_CHECK(cell) if((cell) >= size) { putChar(m_memory.m_dummy); return memoryError(ip - code, dp); }
+
+		do {
+			switch(ip->op) {
+				case OP_SHIFT_RIGHT : dp += ip->data;
+				break;
+				case OP_SHIFT_LEFT : dp -= ip->data;
+				break;
+				case OP_INCREMENT : CHECK(dp + ip->offset); cells[dp + ip->offset] += ip->data;
+				break;
+				case OP_DECREMENT : CHECK(dp + ip->offset); cells[dp + ip->offset] -= ip->data;
+				break;
+				case OP_START_LOOP : CHECK(dp); if(cells[dp] == 0) ip = code + ip->data;
+				break;
+				case OP_END_LOOP : CHECK(dp); if(cells[dp] != 0) ip = code + ip->data;
+				break;
+				case OP_INPUT : CHECK(dp + ip->offset); cells[dp + ip->offset] = getChar(cells[dp + ip->offset]);
+				break;
+				case OP_OUTPUT : OUTPUT_CHECK(dp + ip->offset); putChar(cells[dp + ip->offset]);
+				break;
+				case OP_PRINT : putString(constants + ip->data, ip->offset);
+				break;
+				case OP_CLEAR : CHECK(dp + ip->offset); cells[dp + ip->offset] = 0;
+				break;
+				case OP_SET : CHECK(dp + ip->offset); cells[dp + ip->offset] = ip->data;
+				break;
+				case OP_MULTIPLY : CHECK(dp);
+					if(cells[dp] != 0) {
+						CHECK(dp + ip->offset);
+						cells[dp + ip->offset] += cells[dp] * ip->data;
+					}
+				break;
+				case OP_SCAN_RIGHT : dp = m_memory.scanRight(dp, ip->data); CHECK(dp);
+				break;
+				case OP_SCAN_LEFT : dp = m_memory.scanLeft(dp, ip->data); CHECK(dp);
+				break;
+				case OP_UNMATCHED :
+					if(ip->data == START_LOOP) {
+						CHECK(dp);
+						if(cells[dp] != 0) break;
+					}
+
+					return unmatchedError(ip - code, dp);
+				case OP_HALT :
+					m_pc = ip - code;
+					m_instPtr = m_origin[m_pc];
+					m_dataPtr = dp;
+
+					if(single) {
+						m_error = "Execution gone past end of program";
+						return false;
+					}
+
+					return true;
+				default : break;
+			}
+
+			ip++;
+		} while(!single);
+
+		#undef CHECK
+		#undef OUTPUT_CHECK
+
+		m_pc = ip - code;
+		m_instPtr = m_origin[m_pc];
+		m_dataPtr = dp;
+
+		return true;
+	}
+
+	/**
+	* This steps the execution a single step, through the switch loop.
+	*
+	* @return True if the instruction was executed successfully.
+	*/
+	bool ThreadedInterpreter::step() {
+		if(m_code.empty()) {
+			m_error = "No program provided";
+			return false;
+		}
+
+		flushPreRun();
+
+		bool success = m_memory.m_cells != nullptr ? dispatchSwitch(m_memory.m_cells, true) : dispatchSwitch(SparseCells{m_memory}, true);
+
+		flushOutput();
+
+		return success;
+	}
+
+	/**
+	* Runs the program through the threaded dispatch, unless a run speed
+	* is set, in which case it steps like the BasicInterpreter does.
+	*
+	* @param runSpeed The speed to run at in Instructions per second
+	*
+	* @return True if the program executed successfully.
+	*/
+	bool ThreadedInterpreter::run(float runSpeed) {
+		if(m_code.empty()) {
+			m_error = "No program provided";
+			return false;
+		}
+
+		flushPreRun();
+
+		if(runSpeed <= 0) {
+			bool success = m_memory.m_cells != nullptr ? dispatchThreaded(m_memory.m_cells) : dispatchThreaded(SparseCells{m_memory});
+
+			flushOutput();
+
+			return success;
+		}
+
+		//Initialize variables for timing
+		int milliPerInst = 1 / runSpeed;
+		std::chrono::milliseconds delta;
+		auto execTime = std::chrono::milliseconds(milliPerInst);
+		auto currentTime = std::chrono::steady_clock::now();
+		auto lastTime = currentTime;
+
+		while(m_code[m_pc].op != OP_HALT) {
+			currentTime = std::chrono::steady_clock::now();
+			delta = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - lastTime);
+			lastTime = currentTime;
+
+			//Should the execution be stopped for a bit to stay in time
+			if(delta > execTime) {
+				std::this_thread::sleep_for(delta - execTime);
+			}
+
+			if(!step()) return false;
+		}
+
+		return true;
+	}
+
+}
@@ -0,0 +1,62 @@
+#include "jit/JITInterpreter.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+//Times compiling programs from 10KB up to 10MB with the JIT, the time per byte should stay about
+//the same at every size if labels are resolved in linear time. The programs aren't processed or run,
+//so it's only the code generation being timed.
+//Build with: g++ -std=c++17 -O2 -Iinclude src/benchcompile.cpp src/Interpreter.cpp src/Memory.cpp src/Input.cpp src/Output.cpp
+//            src/Program.cpp src/PassManager.cpp src/ProgramCache.cpp src/Decoder.cpp src/jit/Emitter.cpp src/jit/Runtime.cpp src/jit/CodeCache.cpp src/jit/Executable.cpp src/jit/JITInterpreter.cpp
+
+#if defined(USE_JIT)
+
+//Loops nested depth deep over and over, like hanoi.b's, or one after another when depth is 1
+std::string generate(std::size_t size, std::size_t depth) {
+    std::string block = std::string(depth, '[') + "->+<" + std::string(depth, ']') + "+>";
+    std::string source;
+    source.reserve(size + block.size());
+
+    while(source.size() < size)
+        source += block;
+
+    return source;
+}
+
+int main(int argc, char *argv[]) {
+    std::size_t maxSize = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10000000;
+
+    for(std::size_t depth : {1, 64, 4096}) {
+        printf("nesting depth %zu\n", depth);
+
+        for(std::size_t size = 10000; size <= maxSize; size *= 10) {
+            std::string source = generate(size, depth);
+            bs::jit::JITInterpreter interpreter;
+
+            auto start = std::chrono::steady_clock::now();
+
+            if(!interpreter.loadProgram(source.c_str(), false)) {
+                printf("%s\n", interpreter.getError().c_str());
+                return 1;
+            }
+
+            auto end = std::chrono::steady_clock::now();
+            double millis = std::chrono::duration<double, std::milli>(end - start).count();
+
+            printf("%10zu bytes %10.2f ms %8.2f ns/byte\n", source.size(), millis, millis * 1e6 / source.size());
+        }
+    }
+
+    return 0;
+}
+
+#else
+
+int main() {
+    printf("The JIT isn't supported on this platform\n");
+    return 1;
+}
+
+#endif
@@ -0,0 +1,128 @@
+#include "Program.hpp"
+#include "Decoder.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//Runs a program through a plain switch over the 12 byte Tokens and through a switch over the
+//8 byte decoded Instructions, with no bounds checks or I/O so only the dispatch is being timed.
+//Build with: g++ -std=c++17 -O2 -Iinclude src/benchdecode.cpp src/Program.cpp src/PassManager.cpp src/Decoder.cpp
+//Run with a program that doesn't read input, like examples/mandelbrot.b
+
+const std::size_t TAPE_SIZE = 1 << 16;
+
+std::size_t runTokens(const bs::Program &program, unsigned char *cells) {
+    const std::vector<bs::Token> &tokens = program.tokens;
+    std::size_t ip = 0, dp = 0, output = 0;
+
+    while(ip < tokens.size()) {
+        const bs::Token &token = tokens[ip];
+
+        switch(token.identifier) {
+            case bs::SHIFT_RIGHT : dp += token.data; break;
+            case bs::SHIFT_LEFT : dp -= token.data; break;
+            case bs::INCREMENT : cells[dp + token.offset] += token.data; break;
+            case bs::DECREMENT : cells[dp + token.offset] -= token.data; break;
+            case bs::START_LOOP : if(cells[dp] == 0) ip = token.data; break;
+            case bs::END_LOOP : if(cells[dp] != 0) ip = token.data; break;
+            case bs::OUTPUT : output += cells[dp + token.offset]; break;
+            case bs::PRINT : output += token.data; break;
+            case bs::CLEAR : cells[dp + token.offset] = 0; break;
+            case bs::SET : cells[dp + token.offset] = token.data; break;
+            case bs::MULTIPLY : cells[dp + token.offset] += cells[dp] * token.data; break;
+            case bs::SCAN_RIGHT : while(cells[dp] != 0) dp += token.data; break;
+            case bs::SCAN_LEFT : while(cells[dp] != 0) dp -= token.data; break;
+        }
+
+        ip++;
+    }
+
+    return output;
+}
+
+std::size_t runInstructions(const std::vector<bs::Instruction> &code, unsigned char *cells) {
+    const bs::Instruction *ip = code.data();
+    std::size_t dp = 0, output = 0;
+
+    for(;; ip++) {
+        switch(ip->op) {
+            case bs::OP_SHIFT_RIGHT : dp += ip->data; break;
+            case bs::OP_SHIFT_LEFT : dp -= ip->data; break;
+            case bs::OP_INCREMENT : cells[dp + ip->offset] += ip->data; break;
+            case bs::OP_DECREMENT : cells[dp + ip->offset] -= ip->data; break;
+            case bs::OP_START_LOOP : if(cells[dp] == 0) ip = code.data() + ip->data; break;
+            case bs::OP_END_LOOP : if(cells[dp] != 0) ip = code.data() + ip->data; break;
+            case bs::OP_OUTPUT : output += cells[dp + ip->offset]; break;
+            case bs::OP_PRINT : output += ip->offset; break;
+            case bs::OP_CLEAR : cells[dp + ip->offset] = 0; break;
+            case bs::OP_SET : cells[dp + ip->offset] = ip->data; break;
+            case bs::OP_MULTIPLY : cells[dp + ip->offset] += cells[dp] * ip->data; break;
+            case bs::OP_SCAN_RIGHT : while(cells[dp] != 0) dp += ip->data; break;
+            case bs::OP_SCAN_LEFT : while(cells[dp] != 0) dp -= ip->data; break;
+            case bs::OP_HALT : return output;
+            default : break;
+        }
+    }
+}
+
+//The checksum of the output keeps the runs from being optimized away, and should match between them
+template<typename F>
+double timeRun(F run, std::size_t &checksum) {
+    auto start = std::chrono::steady_clock::now();
+    checksum = run();
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+int main(int argc, char *argv[]) {
+    if(argc < 2) {
+        printf("Usage: benchdecode <program.b>\n");
+        return 1;
+    }
+
+    std::ifstream file(argv[1]);
+    std::stringstream source;
+    source << file.rdbuf();
+
+    bs::IREmitter emitter;
+    emitter.loadSource(source.str().c_str());
+    emitter.tokenize();
+
+    if(!emitter.expr()) {
+        printf("%s\n", emitter.getError().c_str());
+        return 1;
+    }
+
+    emitter.optimize(2);
+
+    bs::Program program = emitter.emit();
+    std::vector<bs::Instruction> code;
+    std::vector<std::size_t> origin;
+    std::string error;
+
+    if(!bs::decode(program, code, origin, error)) {
+        printf("%s\n", error.c_str());
+        return 1;
+    }
+
+    printf("%zu tokens, %zu bytes as Tokens, %zu bytes as Instructions\n", program.tokens.size(),
+        program.tokens.size() * sizeof(bs::Token), code.size() * sizeof(bs::Instruction));
+
+    //The pointer starts in the middle so neither loop has to check the bounds
+    std::vector<unsigned char> tokenTape(TAPE_SIZE), instructionTape(TAPE_SIZE);
+
+    std::size_t checksum;
+
+    double tokenMillis = timeRun([&] { return runTokens(program, tokenTape.data() + TAPE_SIZE / 2); }, checksum);
+    printf("tokens:       %10.2f ms (checksum %zu)\n", tokenMillis, checksum);
+
+    double instructionMillis = timeRun([&] { return runInstructions(code, instructionTape.data() + TAPE_SIZE / 2); }, checksum);
+    printf("instructions: %10.2f ms (checksum %zu)\n", instructionMillis, checksum);
+
+    return 0;
+}
@@ -0,0 +1,59 @@
+#include "Program.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+//Times loading and optimizing programs from 10KB up to 100MB, the time per byte
+//should stay about the same at every size if the passes are linear.
+//Build with: g++ -std=c++17 -O2 -Iinclude src/benchoptimize.cpp src/Program.cpp src/PassManager.cpp
+
+//Has comments, runs, linear loops, scan loops, nested loops and tokens that cancel out
+const std::string chunk =
+    "Hello World ++++++++[>++++[>++>+++>+++>+<<<<-]>+>+>->>+[<]<-]>>.>---.+++++++..+++.>>.<-.<.\n"
+    "[-]>[-<+>]<+-+-><><>+>[>>>>]<<[<]>>[>[->+<]<-]>+<-. with words in between\n";
+
+std::string generate(std::size_t size) {
+    //Start with something so the first loop isn't taken as a comment loop
+    std::string source = "+";
+    source.reserve(size + chunk.size());
+
+    while(source.size() < size)
+        source += chunk;
+
+    return source;
+}
+
+int main(int argc, char *argv[]) {
+    std::size_t maxSize = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 100000000;
+
+    for(std::size_t size = 10000; size <= maxSize; size *= 10) {
+        std::string source = generate(size);
+        bs::IREmitter emitter;
+
+        auto start = std::chrono::steady_clock::now();
+
+        emitter.loadSource(source.c_str());
+        emitter.tokenize();
+
+        if(!emitter.expr()) {
+            printf("%s\n", emitter.getError().c_str());
+            return 1;
+        }
+
+        emitter.optimize(2);
+
+        std::size_t tokens = emitter.emit().tokens.size();
+
+        auto end = std::chrono::steady_clock::now();
+        double millis = std::chrono::duration<double, std::milli>(end - start).count();
+
+        printf("%10zu bytes %10zu tokens %10.2f ms %8.2f ns/byte\n", source.size(), tokens, millis, millis * 1e6 / source.size());
+
+        for(const bs::PassStats &stats : emitter.getPassStats())
+            printf("    %-16s %10.2f ms %10zu -> %zu tokens\n", stats.name.c_str(), stats.millis, stats.tokensBefore, stats.tokensAfter);
+    }
+
+    return 0;
+}
@@ -0,0 +1,221 @@
+#include "config.hpp"
+
+#if defined(USE_JIT)
+
+#include "jit/CodeCache.hpp"
+#include "ProgramCache.hpp"
+
+#if defined(USE_MMAP)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+namespace bs {
+
+namespace jit {
+
+    //Fills in everything but the sizes of the code
+    CodeCache::Header CodeCache::makeHeader(const Program &program, unsigned int level, bool numInput,
+                                            std::size_t tapeSize, std::size_t tapeStart, std::size_t tapeSlack, std::size_t resume) {
+        Header header;
+
+        std::memset(&header, 0, sizeof(Header));
+        std::memcpy(header.magic, "BSJT", 4);
+        header.version = VERSION;
+        header.emitterVersion = x86_64Emitter::VERSION;
+        header.level = level;
+        header.sourceHash = hashBytes(program.source.data(), program.source.size());
+        header.sourceLength = program.source.size();
+        header.tapeSize = tapeSize;
+        header.tapeStart = tapeStart;
+        header.resume = resume;
+        header.processed = program.processed;
+        header.numInput = numInput;
+    #if defined(PLATFORM_WINDOWS)
+        header.abi = ABI_WINDOWS;
+    #else
+        header.abi = ABI_SYSTEM_V;
+    #endif
+    #if defined(USE_GUARD_PAGES)
+        header.flags |= CODE_GUARD_PAGES;
+    #endif
+        header.tapeSlack = tapeSlack;
+        header.programSize = program.processed ? program.tokens.size() : program.source.size();
+        header.constantsLength = program.constants.size();
+
+        return header;
+    }
+
+    //The file name has everything the compiled program depends on in it
+    std::string CodeCache::path(const Header &header) {
+        std::stringstream name;
+
+        name << std::hex << hashBytes(&header, offsetof(Header, codeSize)) << ".bsjt";
+
+        return (std::filesystem::path(m_directory) / name.str()).string();
+    }
+
+    /**
+     * Looks for the compiled program, and puts its code into the emitter if it's there.
+     * The relocations still have to be filled in before it can run. A file with a relocation
+     * or code map entry that points outside the code or program is treated as a miss.
+     *
+     * @return True if the emitter now has the compiled program.
+     */
+    bool CodeCache::load(const Header &expected, x86_64Emitter &emitter, std::vector<Relocation> &relocations, CodeMap &codeMap) {
+        if(!enabled())
+            return false;
+
+        std::string file = path(expected);
+        std::size_t size;
+        const char *data;
+
+    #if defined(USE_MMAP)
+        int fd = open(file.c_str(), O_RDONLY);
+        struct stat info;
+
+        if(fd < 0)
+            return false;
+
+        if(fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) < sizeof(Header)) {
+            close(fd);
+            return false;
+        }
+
+        size = info.st_size;
+        void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+
+        if(map == MAP_FAILED)
+            return false;
+
+        data = static_cast<const char*>(map);
+    #else
+        std::ifstream stream(file, std::ios::binary);
+
+        if(!stream.good())
+            return false;
+
+        std::vector<char> contents((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+        size = contents.size();
+        data = contents.data();
+
+        if(size < sizeof(Header))
+            return false;
+    #endif
+
+        Header header;
+        std::memcpy(&header, data, sizeof(Header));
+
+        //Everything but the sizes has to be the same, and the sizes have to add up to the file
+        std::size_t left = size - sizeof(Header);
+        bool valid = std::memcmp(&header, &expected, offsetof(Header, codeSize)) == 0 &&
+                     header.codeSize <= left &&
+                     header.relocationCount <= (left - header.codeSize) / sizeof(Relocation) &&
+                     header.codeMapCount <= (left - header.codeSize - header.relocationCount * sizeof(Relocation)) / (2 * sizeof(uint64_t)) &&
+                     header.codeSize + header.relocationCount * sizeof(Relocation) + header.codeMapCount * 2 * sizeof(uint64_t) == left;
+
+        if(valid) {
+            const char *code = data + sizeof(Header);
+            const char *relocation = code + header.codeSize;
+            const char *mapping = relocation + header.relocationCount * sizeof(Relocation);
+
+            emitter.clear();
+            emitter.emitCode(reinterpret_cast<const uint8_t*>(code), header.codeSize);
+
+            relocations.resize(header.relocationCount);
+            std::memcpy(relocations.data(), relocation, header.relocationCount * sizeof(Relocation));
+
+            //Every address has to be inside the code, so a bad file can't write anywhere else, and only
+            //the constants are addressed past where their base is
+            for(const Relocation &entry : relocations) {
+                if(entry.kind > RELOC_PRINT || entry.location + sizeof(uint64_t) > header.codeSize)
+                    valid = false;
+                else if(entry.addend > (entry.kind == RELOC_CONSTANTS ? header.constantsLength : 0))
+                    valid = false;
+            }
+
+            codeMap.resize(header.codeMapCount);
+
+            //The entries are searched by their offset into the code, so they have to stay in order,
+            //and the instruction they give is used to report errors
+            for(std::size_t i = 0; i < header.codeMapCount; i++) {
+                uint64_t entry[2];
+                std::memcpy(entry, mapping + i * sizeof(entry), sizeof(entry));
+                codeMap[i] = std::make_pair(entry[0], entry[1]);
+
+                if(entry[0] > header.codeSize || entry[1] > header.programSize || (i != 0 && entry[0] < codeMap[i - 1].first))
+                    valid = false;
+            }
+
+            if(!valid) {
+                emitter.clear();
+                relocations.clear();
+                codeMap.clear();
+            }
+        }
+
+    #if defined(USE_MMAP)
+        munmap(const_cast<char*>(data), size);
+    #endif
+
+        return valid;
+    }
+
+    /**
+     * Writes the compiled program in the emitter to the cache. It goes to a temporary
+     * file first and gets renamed, so nothing ever sees half of a file.
+     *
+     * @return True if it was written.
+     */
+    bool CodeCache::store(Header header, const x86_64Emitter &emitter, const std::vector<Relocation> &relocations, const CodeMap &codeMap) {
+        if(!enabled())
+            return false;
+
+        std::string file = path(header);
+        std::string temp = file + "." + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+        std::error_code error;
+
+        header.codeSize = emitter.size();
+        header.relocationCount = relocations.size();
+        header.codeMapCount = codeMap.size();
+
+        std::filesystem::create_directories(m_directory, error);
+
+        std::ofstream stream(temp, std::ios::binary);
+
+        stream.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+        stream.write(reinterpret_cast<const char*>(emitter.getCode()), emitter.size());
+        stream.write(reinterpret_cast<const char*>(relocations.data()), relocations.size() * sizeof(Relocation));
+
+        for(const auto &entry : codeMap) {
+            uint64_t pair[2] = {entry.first, entry.second};
+            stream.write(reinterpret_cast<const char*>(pair), sizeof(pair));
+        }
+
+        stream.close();
+
+        if(!stream.good() || std::rename(temp.c_str(), file.c_str()) != 0) {
+            std::remove(temp.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+} //namespace jit
+
+} //namespace bs
+
+#endif
@@ -4,31 +4,32 @@
 
 #include "jit/Emitter.hpp"
 
-#include <algorithm>
-
 namespace bs {
 
 namespace jit {
 
-    std::vector<uint8_t> x86_64Emitter::getCode() {
-        return m_code;
-    }
-
-    std::size_t x86_64Emitter::size() {
-        return m_code.size();
-    }
+    x86_64Emitter::x86_64Emitter() : m_code(new uint8_t[INITIAL_CAPACITY]), m_capacity(INITIAL_CAPACITY) { }
 
+    //The buffer is kept between programs, so compiling again doesn't allocate unless the code is bigger
     void x86_64Emitter::clear() {
-        m_code.clear();
+        m_size = 0;
+        m_labels.clear();
+        m_patches.clear();
     }
 
-    void x86_64Emitter::emitBytes(std::vector<uint8_t> bytes) {
-        for(uint8_t byte : bytes) {
-            m_code.push_back(byte);
-        }
-    }
+    //Doubles the buffer until count more bytes fit
+    void x86_64Emitter::grow(std::size_t count) {
+        std::size_t capacity = m_capacity;
 
+        while(m_size + count > capacity)
+            capacity *= 2;
 
+        std::unique_ptr<uint8_t[]> code(new uint8_t[capacity]);
+        std::memcpy(code.get(), m_code.get(), m_size);
+
+        m_code = std::move(code);
+        m_capacity = capacity;
+    }
 
     //Select x86-64 Instructions
     //A lot of instructions change the prefix based on whether they are acting on registers
@@ -36,15 +37,15 @@ namespace jit {
 
     //Near returns from a procedure a.k.a the function
     void x86_64Emitter::ret() {
-        emitBytes({0xC3});
+        emitBytes(0xC3);
     }
 
     //Moves a 64 bit immediate value into reg
     void x86_64Emitter::movabs(uint64_t immediate, x64GPRegister reg) {
         if(reg <= rdi) {
-            emitBytes({0x48, static_cast<uint8_t>(0xB8 + reg)}); 
+            emitBytes(0x48, static_cast<uint8_t>(0xB8 + reg)); 
         } else {
-            emitBytes({0x49, static_cast<uint8_t>(0xB8 + (reg - 8))});
+            emitBytes(0x49, static_cast<uint8_t>(0xB8 + (reg - 8)));
         }
 
         emitInt(immediate);
@@ -53,9 +54,9 @@ namespace jit {
     //Moves a 32 bit immediate value into reg
     void x86_64Emitter::mov(uint32_t immediate, x64GPRegister reg) {
         if(reg <= rdi) {
-            emitBytes({0x48, 0xC7, static_cast<uint8_t>(0xC0 + reg)}); 
+            emitBytes(0x48, 0xC7, static_cast<uint8_t>(0xC0 + reg)); 
         } else {
-            emitBytes({0x49, 0xC7, static_cast<uint8_t>(0xC0 + (reg - 8))});
+            emitBytes(0x49, 0xC7, static_cast<uint8_t>(0xC0 + (reg - 8)));
         }
 
         emitInt(immediate);
@@ -68,10 +69,10 @@ namespace jit {
         prefix |= src > rdi ? 0b100 : 0;
 
         uint8_t modrm = 0b11000000;
-        modrm |= src << 3;
-        modrm |= dest;
+        modrm |= (src & 7) << 3;
+        modrm |= dest & 7;
 
-        emitBytes({prefix, 0x89, modrm});
+        emitBytes(prefix, 0x89, modrm);
     }
 
     //Moves the byte pointed to by src into the lowest byte of dest
@@ -84,109 +85,78 @@ namespace jit {
         modrm |= src << 3;
         modrm |= dest;
 
-        emitBytes({prefix, 0x8A, modrm});
+        emitBytes(prefix, 0x8A, modrm);
     }
 
-    //Moves a 8-bit immediate value into the memory pointed to by the register
-    void x86_64Emitter::mov_at_reg(uint8_t immediate, x64GPRegister reg) {
-        if(reg <= rdi) {
-            emitBytes({0xC6});
-
-            if(reg == rsp) {
-                emitBytes({0x04, 0x24});
-            } else if(reg == rbp) {
-                emitBytes({0x45, 0x00});
-            } else {
-                emitBytes({reg});
-            }
-
-            emitInt(immediate);
-        } else {
-            emitBytes({0x41, 0xC6});
-
-            if(reg == r12) {
-                emitBytes({0x04, 0x24});
-            } else if(reg == r13) {
-                emitBytes({0x45, 0x00});
-            } else {
-                emitBytes({static_cast<uint8_t>(reg - 8)});
-            }
-
-            emitInt(immediate);
+    //Moves a 8-bit immediate value into the memory at offset from the address in the register
+    void x86_64Emitter::mov_at_reg(uint8_t immediate, x64GPRegister reg, int32_t offset) {
+        if(reg > rdi) {
+            emitBytes(0x41);
         }
+
+        emitBytes(0xC6);
+        emitMemOperand(0, reg, offset);
+        emitInt(immediate);
     }
 
-    //Moves the lowest 8-bits of rax into the memory pointed to by the register, for byte return values
-    void x86_64Emitter::mov_al_at_reg(x64GPRegister reg) {
-        if(reg <= rdi) {
-            emitBytes({0x88});
-
-            if(reg == rsp) {
-                emitBytes({0x04, 0x24});
-            } else if(reg == rbp) {
-                emitBytes({0x45, 0x00});
-            } else {
-                emitBytes({reg});
-            }
-        } else {
-            emitBytes({0x41, 0x88});
-
-            if(reg == r12) {
-                emitBytes({0x04, 0x24});
-            } else if(reg == r13) {
-                emitBytes({0x45, 0x00});
-            } else {
-                emitBytes({static_cast<uint8_t>(reg - 8)});
-            }
+    //Moves the lowest 8-bits of rax into the memory at offset from the address in the register, for byte return values
+    void x86_64Emitter::mov_al_at_reg(x64GPRegister reg, int32_t offset) {
+        if(reg > rdi) {
+            emitBytes(0x41);
         }
+
+        emitBytes(0x88);
+        emitMemOperand(rax, reg, offset);
     }
 
     //Increments the value in reg
     void x86_64Emitter::inc(x64GPRegister reg) {
         if(reg <= rdi) {
-            emitBytes({0x48, 0xFF, static_cast<uint8_t>(0xC0 + reg)});
+            emitBytes(0x48, 0xFF, static_cast<uint8_t>(0xC0 + reg));
         } else {
-            emitBytes({0x49, 0xFF, static_cast<uint8_t>(0xC0 + (reg - 8))});
+            emitBytes(0x49, 0xFF, static_cast<uint8_t>(0xC0 + (reg - 8)));
         }
     }
 
     //Decrements the value in reg
     void x86_64Emitter::dec(x64GPRegister reg) {
         if(reg <= rdi) {
-            emitBytes({0x48, 0xFF, static_cast<uint8_t>(0xC8 + reg)});
+            emitBytes(0x48, 0xFF, static_cast<uint8_t>(0xC8 + reg));
         } else {
-            emitBytes({0x49, 0xFF, static_cast<uint8_t>(0xC8 + (reg - 8))});
+            emitBytes(0x49, 0xFF, static_cast<uint8_t>(0xC8 + (reg - 8)));
         }
     }
 
-    //Adds the byte value to the byte pointed to by register reg
-    //There is an offset from the pointer, the second to last operand, which is present because
-    //it is impossible to encode r13 without an offset and I don't want to add an edge case.
-    void x86_64Emitter::addb_at_reg(uint8_t value, x64GPRegister reg) {
-        if(reg <= rdi) {
-            emitBytes({0x80, static_cast<uint8_t>(0x40 + reg), 0x00, value});
-        } else {
-            emitBytes({0x41, 0x80, static_cast<uint8_t>(0x40 + (reg - 8)), 0x00, value});
+    //Adds the byte value to the byte at offset from the address in register reg
+    void x86_64Emitter::addb_at_reg(uint8_t value, x64GPRegister reg, int32_t offset) {
+        if(reg > rdi) {
+            emitBytes(0x41);
         }
+
+        emitBytes(0x80);
+        emitMemOperand(0, reg, offset);
+        emitInt(value);
     }
     
-    //Subtracts the byte value from the byte pointed to by register reg
-    void x86_64Emitter::subb_at_reg(uint8_t value, x64GPRegister reg) {
-        if(reg <= rdi) {
-            emitBytes({0x80, static_cast<uint8_t>(0x68 + reg), 0x00, value});
-        } else {
-            emitBytes({0x41, 0x80, static_cast<uint8_t>(0x68 + (reg - 8)), 0x00, value});
+    //Subtracts the byte value from the byte at offset from the address in register reg
+    void x86_64Emitter::subb_at_reg(uint8_t value, x64GPRegister reg, int32_t offset) {
+        if(reg > rdi) {
+            emitBytes(0x41);
         }
+
+        emitBytes(0x80);
+        emitMemOperand(5, reg, offset);
+        emitInt(value);
     }
 
     //Adds the integer value to the value in register reg
     void x86_64Emitter::add_to_reg(uint32_t value, x64GPRegister reg) {
         if(reg == rax) {
-            emitBytes({0x48, 0x05}); //This one is different, for some reason
+            emitBytes(0x48, 0x05); //This one is different, for some reason
         } else if(reg <= rdi) {
-            emitBytes({0x48, 0x81, static_cast<uint8_t>(0xC0 + reg)});
+            emitBytes(0x48, 0x81, static_cast<uint8_t>(0xC0 + reg));
         } else {
-            emitBytes({0x49, 0x81, static_cast<uint8_t>(0xC0 + (reg - 8))});
+            emitBytes(0x49, 0x81, static_cast<uint8_t>(0xC0 + (reg - 8)));
         }
 
         emitInt(value);
@@ -195,11 +165,11 @@ namespace jit {
     //Subtracts the integer value from the value in register reg
     void x86_64Emitter::sub_from_reg(uint32_t value, x64GPRegister reg) {
         if(reg == rax) {
-            emitBytes({0x48, 0x2D}); //This one is different, for some reason
+            emitBytes(0x48, 0x2D); //This one is different, for some reason
         } else if(reg <= rdi) {
-            emitBytes({0x48, 0x81, static_cast<uint8_t>(0xE8 + reg)});
+            emitBytes(0x48, 0x81, static_cast<uint8_t>(0xE8 + reg));
         } else {
-            emitBytes({0x49, 0x81, static_cast<uint8_t>(0xE8 + (reg - 8))});
+            emitBytes(0x49, 0x81, static_cast<uint8_t>(0xE8 + (reg - 8)));
         }
 
         emitInt(value);
@@ -208,99 +178,390 @@ namespace jit {
     //Pushes a register onto the stack
     void x86_64Emitter::push_reg(x64GPRegister reg) {
         if(reg <= rdi) {
-            emitBytes({static_cast<uint8_t>(0x50 + reg)});
+            emitBytes(static_cast<uint8_t>(0x50 + reg));
         } else {
-            emitBytes({0x41, static_cast<uint8_t>(0x50 + (reg - 8))});
+            emitBytes(0x41, static_cast<uint8_t>(0x50 + (reg - 8)));
         }
     }
 
     //Pops a register off the stack
     void x86_64Emitter::pop_reg(x64GPRegister reg) {
         if(reg <= rdi) {
-            emitBytes({static_cast<uint8_t>(0x58 + reg)});
+            emitBytes(static_cast<uint8_t>(0x58 + reg));
         } else {
-            emitBytes({0x41, static_cast<uint8_t>(0x58 + (reg - 8))});
+            emitBytes(0x41, static_cast<uint8_t>(0x58 + (reg - 8)));
         }
     }
 
-    //Compare the contents pointed to by the specified register with the byte value
-    void x86_64Emitter::cmpb_at_reg(uint8_t value, x64GPRegister reg) {
-        if(reg <= rdi) {
-            emitBytes({0x80, static_cast<uint8_t>(0x78 + reg), 0x00, value});
-        } else {
-            emitBytes({0x41, 0x80, static_cast<uint8_t>(0x78 + (reg - 8)), 0x00, value});
+    //Compare the contents at offset from the address in the specified register with the byte value
+    void x86_64Emitter::cmpb_at_reg(uint8_t value, x64GPRegister reg, int32_t offset) {
+        if(reg > rdi) {
+            emitBytes(0x41);
         }
+
+        emitBytes(0x80);
+        emitMemOperand(7, reg, offset);
+        emitInt(value);
+    }
+
+    //Loads the address at offset from the address in base into dest, without touching memory
+    void x86_64Emitter::lea(x64GPRegister base, int32_t offset, x64GPRegister dest) {
+        uint8_t prefix = 0b01001000;
+        prefix |= dest > rdi ? 0b100 : 0;
+        prefix |= base > rdi ? 1 : 0;
+
+        emitBytes(prefix, 0x8D);
+        emitMemOperand(dest, base, offset);
     }
 
     //Jump if not zero, the address is relative
     void x86_64Emitter::jnz(int32_t relative) {
-        emitBytes({0x0F, 0x85});
+        emitBytes(0x0F, 0x85);
         emitInt(relative);
     }
 
     //Jump if zero, the address is relative
     void x86_64Emitter::jz(int32_t relative) {
-        emitBytes({0x0F, 0x84});
+        emitBytes(0x0F, 0x84);
         emitInt(relative);
     }
 
     //Jump if not zero, a label is used and resolved later
-    void x86_64Emitter::jnz(const std::string &label_name) {
-        emitBytes({0x0F, 0x85});
+    void x86_64Emitter::jnz(Label label) {
+        emitBytes(0x0F, 0x85);
         emitInt<uint32_t>(0);
 
-        m_ref_labels.push_back(Label{label_name, m_code.size() - 4, true});
+        m_patches.push_back(Patch{m_size - 4, label});
     }
 
     //Jump if zero, a label is used and resolved later
-    void x86_64Emitter::jz(const std::string &label_name) {
-        emitBytes({0x0F, 0x84});
+    void x86_64Emitter::jz(Label label) {
+        emitBytes(0x0F, 0x84);
         emitInt<uint32_t>(0);
 
-        m_ref_labels.push_back(Label{label_name, m_code.size() - 4, true});
+        m_patches.push_back(Patch{m_size - 4, label});
     }
 
     //Call the function at the address stored in the 64-bit register
     void x86_64Emitter::call_at_reg(x64GPRegister reg) {
         if(reg <= rdi) {
-            emitBytes({0xFF, static_cast<uint8_t>(0xD0 + reg)});
+            emitBytes(0xFF, static_cast<uint8_t>(0xD0 + reg));
+        } else {
+            emitBytes(0x41, 0xFF, static_cast<uint8_t>(0xD0 + (reg - 8)));
+        }
+    }
+
+    //Moves the byte at offset from the address in src into dest, zero extending it
+    void x86_64Emitter::movzxb_at_reg(x64GPRegister src, x64GPRegister dest, int32_t offset) {
+        if(src > rdi || dest > rdi) {
+            emitBytes(static_cast<uint8_t>(0x40 | (dest > rdi ? 0b100 : 0) | (src > rdi ? 1 : 0)));
+        }
+
+        emitBytes(0x0F, 0xB6);
+        emitMemOperand(dest, src, offset);
+    }
+
+    //Multiplies the low 32-bits of reg by the immediate value, anything above 8-bits isn't used by the tape anyway
+    void x86_64Emitter::imul(int32_t immediate, x64GPRegister reg) {
+        if(reg > rdi) {
+            emitBytes(0x45); //Both the source and destination are the same register
+        }
+
+        uint8_t modrm = 0b11000000 | (reg & 7) << 3 | (reg & 7);
+
+        if(immediate >= -128 && immediate <= 127) {
+            emitBytes(0x6B, modrm);
+            emitInt(static_cast<int8_t>(immediate));
+        } else {
+            emitBytes(0x69, modrm);
+            emitInt(immediate);
+        }
+    }
+
+    //Adds the lowest byte of src to the byte at offset from the address in dest
+    void x86_64Emitter::addb_reg_at_reg(x64GPRegister src, x64GPRegister dest, int32_t offset) {
+        //A REX prefix is needed for the low bytes of rsp - rdi, or they would be ah - bh
+        if(src > rbx || dest > rdi) {
+            emitBytes(static_cast<uint8_t>(0x40 | (src > rdi ? 0b100 : 0) | (dest > rdi ? 1 : 0)));
+        }
+
+        emitBytes(0x00);
+        emitMemOperand(src, dest, offset);
+    }
+
+    //Subtracts the lowest byte of src from the byte at offset from the address in dest
+    void x86_64Emitter::subb_reg_at_reg(x64GPRegister src, x64GPRegister dest, int32_t offset) {
+        if(src > rbx || dest > rdi) {
+            emitBytes(static_cast<uint8_t>(0x40 | (src > rdi ? 0b100 : 0) | (dest > rdi ? 1 : 0)));
+        }
+
+        emitBytes(0x28);
+        emitMemOperand(src, dest, offset);
+    }
+
+    //Adds the value in src to the value in dest
+    void x86_64Emitter::add_to_reg(x64GPRegister src, x64GPRegister dest) {
+        uint8_t prefix = 0b01001000;
+        prefix |= dest > rdi ? 1 : 0;
+        prefix |= src > rdi ? 0b100 : 0;
+
+        emitBytes(prefix, 0x01, static_cast<uint8_t>(0b11000000 | (src & 7) << 3 | (dest & 7)));
+    }
+
+    //Subtracts the value in src from the value in dest
+    void x86_64Emitter::sub_from_reg(x64GPRegister src, x64GPRegister dest) {
+        uint8_t prefix = 0b01001000;
+        prefix |= dest > rdi ? 1 : 0;
+        prefix |= src > rdi ? 0b100 : 0;
+
+        emitBytes(prefix, 0x29, static_cast<uint8_t>(0b11000000 | (src & 7) << 3 | (dest & 7)));
+    }
+
+    //Bitwise ands the low 32-bits of reg with the immediate value, the upper 32-bits are cleared
+    void x86_64Emitter::and_reg(uint32_t immediate, x64GPRegister reg) {
+        if(reg == rax) {
+            emitBytes(0x25); //Like add, rax has its own opcode
+        } else if(reg <= rdi) {
+            emitBytes(0x81, static_cast<uint8_t>(0xE0 + reg));
         } else {
-            emitBytes({0x41, 0xFF, static_cast<uint8_t>(0xD0 + (reg - 8))});
+            emitBytes(0x41, 0x81, static_cast<uint8_t>(0xE0 + (reg - 8)));
+        }
+
+        emitInt(immediate);
+    }
+
+    //Sets the flags from the bitwise and of the low 32-bits of both registers
+    void x86_64Emitter::test(x64GPRegister src, x64GPRegister dest) {
+        if(src > rdi || dest > rdi) {
+            emitBytes(static_cast<uint8_t>(0x40 | (src > rdi ? 0b100 : 0) | (dest > rdi ? 1 : 0)));
         }
+
+        emitBytes(0x85, static_cast<uint8_t>(0b11000000 | (src & 7) << 3 | (dest & 7)));
+    }
+
+    //Puts the index of the lowest set bit of src into dest
+    void x86_64Emitter::bsf(x64GPRegister src, x64GPRegister dest) {
+        if(src > rdi || dest > rdi) {
+            emitBytes(static_cast<uint8_t>(0x40 | (dest > rdi ? 0b100 : 0) | (src > rdi ? 1 : 0)));
+        }
+
+        emitBytes(0x0F, 0xBC, static_cast<uint8_t>(0b11000000 | (dest & 7) << 3 | (src & 7)));
+    }
+
+    //Puts the index of the highest set bit of src into dest
+    void x86_64Emitter::bsr(x64GPRegister src, x64GPRegister dest) {
+        if(src > rdi || dest > rdi) {
+            emitBytes(static_cast<uint8_t>(0x40 | (dest > rdi ? 0b100 : 0) | (src > rdi ? 1 : 0)));
+        }
+
+        emitBytes(0x0F, 0xBD, static_cast<uint8_t>(0b11000000 | (dest & 7) << 3 | (src & 7)));
+    }
+
+    //Unconditional jump, a label is used and resolved later
+    void x86_64Emitter::jmp(Label label) {
+        emitBytes(0xE9);
+        emitInt<uint32_t>(0);
+
+        m_patches.push_back(Patch{m_size - 4, label});
+    }
+
+    //Loads 16 bytes at offset from the address in src into dest, it doesn't have to be aligned
+    void x86_64Emitter::movdqu_at_reg(x64GPRegister src, x64XMMRegister dest, int32_t offset) {
+        emitBytes(0xF3);
+
+        if(src > rdi) {
+            emitBytes(0x41);
+        }
+
+        emitBytes(0x0F, 0x6F);
+        emitMemOperand(dest, src, offset);
+    }
+
+    //Bitwise xors src into dest, with itself it is the usual way to zero a register
+    void x86_64Emitter::pxor(x64XMMRegister src, x64XMMRegister dest) {
+        emitBytes(0x66, 0x0F, 0xEF, static_cast<uint8_t>(0b11000000 | dest << 3 | src));
+    }
+
+    //Sets each byte of dest to all ones if it equals the byte in src, or zero if not
+    void x86_64Emitter::pcmpeqb(x64XMMRegister src, x64XMMRegister dest) {
+        emitBytes(0x66, 0x0F, 0x74, static_cast<uint8_t>(0b11000000 | dest << 3 | src));
+    }
+
+    //Gathers the top bit of each byte in src into the low 16-bits of dest
+    void x86_64Emitter::pmovmskb(x64XMMRegister src, x64GPRegister dest) {
+        emitBytes(0x66);
+
+        if(dest > rdi) {
+            emitBytes(0x44);
+        }
+
+        emitBytes(0x0F, 0xD7, static_cast<uint8_t>(0b11000000 | (dest & 7) << 3 | src));
+    }
+
+    //Loads the 64-bit value at offset from the address in src into dest
+    void x86_64Emitter::movq_at_reg(x64GPRegister src, x64GPRegister dest, int32_t offset) {
+        emitBytes(static_cast<uint8_t>(0x48 | (dest > rdi ? 0b100 : 0) | (src > rdi ? 1 : 0)), 0x8B);
+        emitMemOperand(dest, src, offset);
+    }
+
+    //Stores the 64-bit value in src at offset from the address in dest
+    void x86_64Emitter::movq_reg_at_reg(x64GPRegister src, x64GPRegister dest, int32_t offset) {
+        emitBytes(static_cast<uint8_t>(0x48 | (src > rdi ? 0b100 : 0) | (dest > rdi ? 1 : 0)), 0x89);
+        emitMemOperand(src, dest, offset);
+    }
+
+    //Sets the flags from dest minus src
+    void x86_64Emitter::cmp(x64GPRegister src, x64GPRegister dest) {
+        uint8_t prefix = 0b01001000;
+        prefix |= dest > rdi ? 1 : 0;
+        prefix |= src > rdi ? 0b100 : 0;
+
+        emitBytes(prefix, 0x39, static_cast<uint8_t>(0b11000000 | (src & 7) << 3 | (dest & 7)));
+    }
+
+    //Compares the low byte of rax with the value, it has its own short opcode
+    void x86_64Emitter::cmp_al(uint8_t value) {
+        emitBytes(0x3C, value);
+    }
+
+    //Jump if less or equal, after a test that's when the value is zero or negative
+    void x86_64Emitter::jle(Label label) {
+        emitBytes(0x0F, 0x8E);
+        emitInt<uint32_t>(0);
+
+        m_patches.push_back(Patch{m_size - 4, label});
+    }
+
+    //Calls into the kernel with the number in rax, the return address and flags are left in rcx and r11
+    void x86_64Emitter::syscall() {
+        emitBytes(0x0F, 0x05);
+    }
+
+    //Adds the byte value to the low byte of reg, the rest of the register is left alone
+    void x86_64Emitter::addb_reg(uint8_t value, x64GPRegister reg) {
+        emitBytes(0x80, static_cast<uint8_t>(0xC0 + reg), value);
+    }
+
+    //Subtracts the byte value from the low byte of reg
+    void x86_64Emitter::subb_reg(uint8_t value, x64GPRegister reg) {
+        emitBytes(0x80, static_cast<uint8_t>(0xE8 + reg), value);
+    }
+
+    //Moves the byte value into the low byte of reg, without touching the flags
+    void x86_64Emitter::movb_reg(uint8_t value, x64GPRegister reg) {
+        emitBytes(static_cast<uint8_t>(0xB0 + reg), value);
+    }
+
+    //Stores the low byte of src at offset from the address in dest
+    void x86_64Emitter::movb_reg_at_reg(x64GPRegister src, x64GPRegister dest, int32_t offset) {
+        if(dest > rdi) {
+            emitBytes(0x41);
+        }
+
+        emitBytes(0x88);
+        emitMemOperand(src, dest, offset);
+    }
+
+    //Zero extends the low byte of src into dest
+    void x86_64Emitter::movzxb_reg(x64GPRegister src, x64GPRegister dest) {
+        emitBytes(0x0F, 0xB6, static_cast<uint8_t>(0b11000000 | dest << 3 | src));
+    }
+
+    //Sets the flags from the low bytes of src and dest anded together, the zero flag is set when testing a byte with itself is zero
+    void x86_64Emitter::testb(x64GPRegister src, x64GPRegister dest) {
+        emitBytes(0x84, static_cast<uint8_t>(0b11000000 | src << 3 | dest));
+    }
+
+    //Jump if below, after a cmp that's when the destination was less than the source as unsigned values
+    void x86_64Emitter::jb(Label label) {
+        emitBytes(0x0F, 0x82);
+        emitInt<uint32_t>(0);
+
+        m_patches.push_back(Patch{m_size - 4, label});
     }
 
-    //Create a label at the current memory location, duplicates aren't added
-    void x86_64Emitter::emitLabel(const std::string &label_name) {
-        auto iter = std::find(m_src_labels.begin(), m_src_labels.end(), label_name);
+    //Jump if above, after a cmp that's when the destination was more than the source as unsigned values
+    void x86_64Emitter::ja(Label label) {
+        emitBytes(0x0F, 0x87);
+        emitInt<uint32_t>(0);
+
+        m_patches.push_back(Patch{m_size - 4, label});
+    }
+
+    //Jump if above or equal, after a cmp that's when the destination wasn't less than the source as unsigned values
+    void x86_64Emitter::jae(Label label) {
+        emitBytes(0x0F, 0x83);
+        emitInt<uint32_t>(0);
+
+        m_patches.push_back(Patch{m_size - 4, label});
+    }
+
+    //Calls code at a label, it's relative like a jmp
+    void x86_64Emitter::call(Label label) {
+        emitBytes(0xE8);
+        emitInt<uint32_t>(0);
+
+        m_patches.push_back(Patch{m_size - 4, label});
+    }
 
-        if(iter != m_src_labels.end()) {
-            return;
+    //Emits the ModRM byte, and SIB byte and displacement if needed, for a memory operand at offset from base.
+    //rsp and r12 always need a SIB byte, and rbp and r13 always need a displacement.
+    void x86_64Emitter::emitMemOperand(uint8_t reg, x64GPRegister base, int32_t offset) {
+        uint8_t mod;
+
+        if(offset == 0 && (base & 7) != rbp) {
+            mod = 0b00;
+        } else if(offset >= -128 && offset <= 127) {
+            mod = 0b01;
+        } else {
+            mod = 0b10;
+        }
+
+        emitBytes(static_cast<uint8_t>(mod << 6 | (reg & 7) << 3 | (base & 7)));
+
+        if((base & 7) == rsp) {
+            emitBytes(0x24);
         }
 
-        m_src_labels.push_back(Label{label_name, m_code.size(), false});
+        if(mod == 0b01) {
+            emitInt(static_cast<int8_t>(offset));
+        } else if(mod == 0b10) {
+            emitInt(offset);
+        }
+    }
+
+    //Makes a label that isn't placed anywhere yet
+    Label x86_64Emitter::newLabel() {
+        m_labels.push_back(UNBOUND);
+        return m_labels.size() - 1;
+    }
+
+    //Places the label at the current memory location
+    void x86_64Emitter::bind(Label label) {
+        m_labels[label] = m_size;
     }
 
     //Resolve the labels, return whether it succeeded
     bool x86_64Emitter::resolveLabels() {
-        //Loop through reference labels and calculate the relative offset from the source label
-        for(const Label &label : m_ref_labels) {
-            auto iter = std::find(m_src_labels.begin(), m_src_labels.end(), label.name);
+        //Calculate the relative offset of each jump from its label
+        for(const Patch &patch : m_patches) {
+            std::size_t target = m_labels[patch.label];
 
-            if(iter == m_src_labels.end()) {
+            if(target == UNBOUND) {
                 return false;
             }
 
             //Subtract 4 because the offset starts from the byte after the instruction but the location is at the start of the operand
-            int32_t offset = iter->location - label.location - 4;
+            int32_t offset = target - patch.location - 4;
 
-            m_code[label.location + 0] = GET_BYTE(offset, 0);
-            m_code[label.location + 1] = GET_BYTE(offset, 1);
-            m_code[label.location + 2] = GET_BYTE(offset, 2);
-            m_code[label.location + 3] = GET_BYTE(offset, 3);
+            m_code[patch.location + 0] = GET_BYTE(offset, 0);
+            m_code[patch.location + 1] = GET_BYTE(offset, 1);
+            m_code[patch.location + 2] = GET_BYTE(offset, 2);
+            m_code[patch.location + 3] = GET_BYTE(offset, 3);
         }
 
-        m_src_labels.clear();
-        m_ref_labels.clear();
+        m_labels.clear();
+        m_patches.clear();
 
         return true;
     }
@@ -0,0 +1,369 @@
+#include "config.hpp"
+
+#if defined(USE_AOT)
+
+#include "jit/Executable.hpp"
+#include "Memory.hpp"
+
+#include <elf.h>
+#include <ucontext.h>
+
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace bs {
+
+namespace jit {
+
+    //Where everything goes in the executable's memory, the code and constants have to fit below DATA_ADDRESS
+    constexpr uint64_t TEXT_ADDRESS = 0x400000;
+    constexpr uint64_t DATA_ADDRESS = 0x10000000;
+    constexpr uint64_t PAGE_SIZE = 0x1000;
+    constexpr std::size_t HEADERS_SIZE = sizeof(Elf64_Ehdr) + 3 * sizeof(Elf64_Phdr);
+
+    //Offsets into the data segment, everything before INPUT_BUFFER is in the file and the rest is bss
+    constexpr uint64_t INPUT = 0;        //The input buffer's next and end pointers
+    constexpr uint64_t INPUT_ENDED = 32; //Set once a read finds the end of the input
+    constexpr uint64_t OUTPUT = 64;      //The output buffer's next and end pointers
+    constexpr uint64_t SIGNAL = 128;     //The sigaction the kernel takes for the fault handler
+    constexpr uint64_t DATA_SIZE = 160;
+    constexpr uint64_t INPUT_BUFFER = PAGE_SIZE;
+
+    constexpr uint64_t SIGNAL_FLAGS = SA_SIGINFO | 0x04000000; //The handler gets the registers, and returns through sa_restorer which x86_64 needs
+    constexpr uint32_t SIGNAL_FAULT = 11;
+
+    enum SYSTEM_CALL : uint32_t {
+        CALL_READ = 0,
+        CALL_WRITE = 1,
+        CALL_MPROTECT = 10,
+        CALL_SIGACTION = 13,
+        CALL_SIGRETURN = 15,
+        CALL_EXIT = 231 //exit_group
+    };
+
+    const char FAULT_MESSAGE[] = "Error: Out-of-Bounds memory access\n";
+
+    static uint64_t roundUp(uint64_t value, uint64_t to) {
+        return (value + to - 1) / to * to;
+    }
+
+    bool writeExecutable(const std::string &path, const x86_64Emitter &program, const std::vector<Relocation> &relocations,
+                         const std::string &constants, const ExecutableOptions &options, std::string &error) {
+        //The pointer pairs have to fit in the space they're given
+        constexpr int32_t inputSpace = static_cast<int32_t>(INPUT_ENDED - INPUT - 8);
+        constexpr int32_t outputSpace = static_cast<int32_t>(SIGNAL - OUTPUT - 8);
+
+        if(options.inputEnd < 8 || options.inputEnd > inputSpace || options.outputEnd < 8 || options.outputEnd > outputSpace) {
+            error = "The input and output buffers don't fit the executable's layout";
+            return false;
+        }
+
+        //The output buffer is after the input buffer, then the tape between its guard pages
+        uint64_t input = DATA_ADDRESS + INPUT;
+        uint64_t output = DATA_ADDRESS + OUTPUT;
+        uint64_t inputBuffer = DATA_ADDRESS + INPUT_BUFFER;
+        uint64_t outputBuffer = inputBuffer + InputReader::BUFFER_SIZE;
+        uint64_t outputCapacity = options.outputBuffer + 1; //OutputWriter writes once it's full instead of once it goes over
+        uint64_t lowGuard = roundUp(outputBuffer + outputCapacity, PAGE_SIZE);
+        uint64_t tape = lowGuard + Tape::GUARD_SIZE;
+        uint64_t highGuard = tape + roundUp(options.tapeSize, PAGE_SIZE);
+        uint64_t dataEnd = highGuard + Tape::GUARD_SIZE;
+
+        //The constants go first so their addresses are known before any code
+        x86_64Emitter text;
+        uint64_t base = TEXT_ADDRESS + HEADERS_SIZE;
+
+        uint64_t message = base + text.size();
+        text.emitCode(reinterpret_cast<const uint8_t*>(FAULT_MESSAGE), sizeof(FAULT_MESSAGE) - 1);
+
+        uint64_t strings = base + text.size();
+        text.emitCode(reinterpret_cast<const uint8_t*>(constants.data()), constants.size());
+
+        //Writes the output buffer to standard output, giving up on it if the write fails like OutputWriter
+        uint64_t flush = base + text.size();
+        Label write = text.newLabel();
+        Label written = text.newLabel();
+
+        text.movabs(output, r8);
+        text.movabs(outputBuffer, rsi);
+        text.movq_at_reg(r8, rdx);
+        text.sub_from_reg(rsi, rdx);
+        text.bind(write);
+        text.test(rdx, rdx);
+        text.jz(written);
+        text.mov(CALL_WRITE, rax);
+        text.mov(1, rdi);
+        text.syscall();
+        text.test(rax, rax);
+        text.jle(written);
+        text.add_to_reg(rax, rsi);
+        text.sub_from_reg(rax, rdx);
+        text.jmp(write);
+        text.bind(written);
+        text.movabs(outputBuffer, rax);
+        text.movq_reg_at_reg(rax, r8);
+        text.ret();
+
+        //func_print(), the string is in rsi and its length in rdx
+        uint64_t print = base + text.size();
+        Label character = text.newLabel();
+        Label printed = text.newLabel();
+
+        text.bind(character);
+        text.test(rdx, rdx);
+        text.jz(printed);
+        text.movabs(output, r8);
+        text.movq_at_reg(r8, rcx);
+        text.movzxb_at_reg(rsi, rax);
+        text.mov_al_at_reg(rcx);
+        text.inc(rcx);
+        text.movq_reg_at_reg(rcx, r8);
+        text.inc(rsi);
+        text.dec(rdx);
+        text.movq_at_reg(r8, rax, options.outputEnd);
+        text.cmp(rcx, rax);
+        text.jnz(character);
+        text.push_reg(rsi);
+        text.push_reg(rdx);
+        text.movabs(flush, rax);
+        text.call_at_reg(rax);
+        text.pop_reg(rdx);
+        text.pop_reg(rsi);
+        text.jmp(character);
+        text.bind(printed);
+        text.ret();
+
+        //func_getChar(), only called once the input buffer is empty, the cell is in rsi and the byte goes in al
+        uint64_t getChar = base + text.size();
+        Label read = text.newLabel();
+        Label strip = text.newLabel();
+        Label stripped = text.newLabel();
+        Label ended = text.newLabel();
+        Label none = text.newLabel();
+
+        text.push_reg(rsi);
+        text.movabs(flush, rax); //Anything printed before asking for input has to show up first
+        text.call_at_reg(rax);
+        text.movabs(input, r8);
+        text.cmpb_at_reg(0, r8, INPUT_ENDED - INPUT);
+        text.jnz(none);
+        text.bind(read);
+        text.mov(CALL_READ, rax);
+        text.mov(0, rdi);
+        text.movabs(inputBuffer, rsi);
+        text.mov(InputReader::BUFFER_SIZE, rdx);
+        text.syscall();
+        text.test(rax, rax);
+        text.jle(ended);
+        text.mov(rsi, rdx);
+        text.add_to_reg(rax, rdx);
+
+        //Line mode takes the input a line at a time without the newlines and skips empty lines, so all that's left is every other byte
+        if(!options.raw) {
+            text.mov(rsi, rcx);
+            text.bind(strip);
+            text.cmp(rdx, rsi);
+            text.jz(stripped);
+            text.movzxb_at_reg(rsi, rax);
+            text.inc(rsi);
+            text.cmp_al('\n');
+            text.jz(strip);
+            text.mov_al_at_reg(rcx);
+            text.inc(rcx);
+            text.jmp(strip);
+            text.bind(stripped);
+            text.movabs(inputBuffer, rsi);
+            text.mov(rcx, rdx);
+            text.cmp(rsi, rdx);
+            text.jz(read);
+        }
+
+        text.movzxb_at_reg(rsi, rax);
+        text.inc(rsi);
+        text.movq_reg_at_reg(rsi, r8);
+        text.movq_reg_at_reg(rdx, r8, options.inputEnd);
+        text.pop_reg(rsi);
+        text.ret();
+        text.bind(ended);
+        text.mov_at_reg(1, r8, INPUT_ENDED - INPUT);
+        text.bind(none);
+        text.pop_reg(rax);
+
+        if(options.eof == EOF_ZERO)
+            text.mov(0, rax);
+        else if(options.eof == EOF_MINUS_ONE)
+            text.mov(255, rax);
+
+        text.ret();
+
+        //Going off the tape into a guard page writes what was printed, then the same error the JIT gives without where it happened.
+        //The code keeps the output buffer's next pointer in r12, so it's taken from the registers the handler gets.
+        uint64_t handler = base + text.size();
+
+        text.movq_at_reg(rdx, rax, offsetof(ucontext_t, uc_mcontext.gregs) + REG_R12 * sizeof(greg_t));
+        text.movabs(output, r8);
+        text.movq_reg_at_reg(rax, r8);
+        text.movabs(flush, rax);
+        text.call_at_reg(rax);
+        text.mov(CALL_WRITE, rax);
+        text.mov(2, rdi);
+        text.movabs(message, rsi);
+        text.mov(sizeof(FAULT_MESSAGE) - 1, rdx);
+        text.syscall();
+        text.mov(CALL_EXIT, rax);
+        text.mov(1, rdi);
+        text.syscall();
+
+        uint64_t restorer = base + text.size();
+
+        text.mov(CALL_SIGRETURN, rax);
+        text.syscall();
+
+        //The entry point, sets up the guard pages and the handler then runs the program from the start of the tape
+        uint64_t start = base + text.size();
+
+        for(uint64_t guard : {lowGuard, highGuard}) {
+            text.mov(CALL_MPROTECT, rax);
+            text.movabs(guard, rdi);
+            text.mov(Tape::GUARD_SIZE, rsi);
+            text.mov(0, rdx);
+            text.syscall();
+        }
+
+        text.mov(CALL_SIGACTION, rax);
+        text.mov(SIGNAL_FAULT, rdi);
+        text.movabs(DATA_ADDRESS + SIGNAL, rsi);
+        text.mov(0, rdx);
+        text.mov(8, r10);
+        text.syscall();
+        text.movabs(tape + options.start, rdi);
+        text.movabs(tape, rsi);
+        text.movabs(tape + options.tapeSize, rdx);
+        text.movabs(0, rax);
+
+        std::size_t programAddress = text.size() - 8;
+
+        text.call_at_reg(rax);
+        text.movabs(flush, rax);
+        text.call_at_reg(rax);
+        text.mov(CALL_EXIT, rax);
+        text.mov(0, rdi);
+        text.syscall();
+
+        if(!text.resolveLabels()) {
+            error = "Failed to resolve labels";
+            return false;
+        }
+
+        //The program goes last, with its addresses pointed at the routines above
+        std::size_t programOffset = text.size();
+
+        text.patchInt<uint64_t>(programAddress, base + programOffset);
+        text.emitCode(program.getCode(), program.size());
+
+        for(const Relocation &relocation : relocations) {
+            uint64_t target = 0;
+
+            switch(relocation.kind) {
+                case RELOC_INPUT : target = input;
+                break;
+                case RELOC_OUTPUT : target = output;
+                break;
+                case RELOC_CONSTANTS : target = strings;
+                break;
+                case RELOC_FLUSH : target = flush;
+                break;
+                case RELOC_GET_CHAR : target = getChar;
+                break;
+                case RELOC_PRINT : target = print;
+                break;
+                default : break; //The instance isn't used by any of the routines
+            }
+
+            text.patchInt<uint64_t>(programOffset + relocation.location, target + relocation.addend);
+        }
+
+        if(base + text.size() > DATA_ADDRESS) {
+            error = "The program is too big to be compiled into an executable";
+            return false;
+        }
+
+        //The data that starts out set, the pointers and the sigaction
+        uint8_t data[DATA_SIZE] = {};
+        auto set = [&data](uint64_t offset, uint64_t value) { std::memcpy(data + offset, &value, sizeof(value)); };
+
+        set(INPUT, inputBuffer);
+        set(INPUT + options.inputEnd, inputBuffer);
+        set(OUTPUT, outputBuffer);
+        set(OUTPUT + options.outputEnd, outputBuffer + outputCapacity);
+        set(SIGNAL, handler);
+        set(SIGNAL + 8, SIGNAL_FLAGS);
+        set(SIGNAL + 16, restorer);
+
+        std::size_t textSize = HEADERS_SIZE + text.size();
+        std::size_t dataOffset = roundUp(textSize, PAGE_SIZE);
+
+        Elf64_Ehdr header = {};
+        std::memcpy(header.e_ident, ELFMAG, SELFMAG);
+        header.e_ident[EI_CLASS] = ELFCLASS64;
+        header.e_ident[EI_DATA] = ELFDATA2LSB;
+        header.e_ident[EI_VERSION] = EV_CURRENT;
+        header.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+        header.e_type = ET_EXEC;
+        header.e_machine = EM_X86_64;
+        header.e_version = EV_CURRENT;
+        header.e_entry = start;
+        header.e_phoff = sizeof(Elf64_Ehdr);
+        header.e_ehsize = sizeof(Elf64_Ehdr);
+        header.e_phentsize = sizeof(Elf64_Phdr);
+        header.e_phnum = 3;
+
+        Elf64_Phdr segments[3] = {};
+
+        segments[0].p_type = PT_LOAD;
+        segments[0].p_flags = PF_R | PF_X;
+        segments[0].p_offset = 0;
+        segments[0].p_vaddr = segments[0].p_paddr = TEXT_ADDRESS;
+        segments[0].p_filesz = segments[0].p_memsz = textSize;
+        segments[0].p_align = PAGE_SIZE;
+
+        segments[1].p_type = PT_LOAD;
+        segments[1].p_flags = PF_R | PF_W;
+        segments[1].p_offset = dataOffset;
+        segments[1].p_vaddr = segments[1].p_paddr = DATA_ADDRESS;
+        segments[1].p_filesz = DATA_SIZE;
+        segments[1].p_memsz = dataEnd - DATA_ADDRESS;
+        segments[1].p_align = PAGE_SIZE;
+
+        segments[2].p_type = PT_GNU_STACK; //Without this the stack would be executable
+        segments[2].p_flags = PF_R | PF_W;
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        std::string padding(dataOffset - textSize, '\0');
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(segments), sizeof(segments));
+        file.write(reinterpret_cast<const char*>(text.getCode()), text.size());
+        file.write(padding.data(), padding.size());
+        file.write(reinterpret_cast<const char*>(data), sizeof(data));
+        file.close();
+
+        if(!file.good()) {
+            error = "Could not write " + path;
+            return false;
+        }
+
+        std::error_code ignored;
+        std::filesystem::permissions(path, std::filesystem::perms::owner_exec | std::filesystem::perms::group_exec | std::filesystem::perms::others_exec,
+                                     std::filesystem::perm_options::add, ignored);
+
+        return true;
+    }
+
+} //namespace jit
+
+} //namespace bs
+
+#endif
@@ -6,101 +6,316 @@
 
 #include "jit/Platform.hpp"
 
+#include <algorithm>
+
 namespace bs {
 
 namespace jit {
 
     //Functions for using in the jit, so I don't have to deal with method pointers
-    void func_printChar(char *c) {
-        std::cout << *c << std::flush;
+    //The cell is loaded by the generated code, so a fault from reading it always happens in there
+    void func_flushOutput(JITInterpreter *instance) {
+        instance->flushOutput();
+    }
+
+    void func_print(JITInterpreter *instance, const char *string, std::size_t length) {
+        instance->putString(string, length);
+    }
+
+    unsigned char func_getChar(JITInterpreter *instance, unsigned char current) {
+        return instance->getChar(current);
+    }
+
+#if defined(USE_GUARD_PAGES)
+    thread_local JITInterpreter *running = nullptr; //Instance whose code is running on this thread
+
+    //Turns a fault in the guard pages around the running tape into a jump back to run(), anything else still crashes
+    void handleFault(int signal, siginfo_t *info, void *context) {
+        JITInterpreter *instance = running;
+
+        if(instance == nullptr || !instance->m_memory.isGuard(info->si_addr)) {
+            std::signal(signal, SIG_DFL); //Returning runs the faulting instruction again, which crashes this time
+            return;
+        }
+
+        mcontext_t &registers = static_cast<ucontext_t*>(context)->uc_mcontext;
+        instance->m_faultAddress = registers.gregs[REG_RIP];
+        instance->m_faultCell = registers.gregs[REG_R13];
+        instance->m_output.m_next = reinterpret_cast<char*>(registers.gregs[REG_R12]); //So what was printed still gets written
+
+        siglongjmp(instance->m_faultJump, 1);
     }
 
-    char func_getChar(JITInterpreter *instance) {
-        return instance->getChar();
-    } 
+    void installFaultHandler() {
+        static bool installed = false;
+
+        if(installed)
+            return;
+
+        struct sigaction action = {};
+        action.sa_sigaction = handleFault;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+
+        sigaction(SIGSEGV, &action, nullptr);
+        installed = true;
+    }
+#endif
 
     //--------------- JIT Interpreter class methods ---------------//
 
-    JITInterpreter::JITInterpreter(std::ostream &stream, bool numInput, std::size_t memSize) : Interpreter(stream, numInput, memSize) { }
+    JITInterpreter::JITInterpreter(std::ostream &stream, bool numInput, std::size_t memSize, TAPE_KIND tape) : Interpreter(stream, numInput, memSize, tape) { }
 
     JITInterpreter::~JITInterpreter() { }
 
     bool JITInterpreter::loadProgram(const char *program, bool process, bool resetDataPtr, unsigned int optimization) {
+        //The compiled code addresses the cells straight through r13, so they have to be in one block
+        if(m_memory.m_cells == nullptr) {
+            m_error = "The JIT can't run on a sparse tape";
+            return false;
+        }
+
+        m_runtime.freeCode(m_code);
+        m_code = nullptr;
+
+        //Compiled code is only cached for programs that start on a fresh tape, like the ones it was cached from
+        bool fresh = resetDataPtr && m_memory.isZero();
+
         m_emitter.loadSource(program);
 
 		m_instPtr = 0;
 
 		if(resetDataPtr)
-			m_dataPtr = 0;
+			m_dataPtr = m_memory.m_start;
 
-		if(process) {
-			m_emitter.tokenize();
+		if(process && !processProgram(optimization, resetDataPtr))
+			return false;
 
-			if(!m_emitter.expr()) { m_error = m_emitter.getError(); return false; } //Program has invalid syntax
+		m_program = m_emitter.emit();
 
-			if(optimization > 0) {
-				m_emitter.optimize(optimization);
+		if(process)
+			preRun();
 
-				//This is called to update the jump locations of the brackets
-				if(!m_emitter.expr()) { m_error = m_emitter.getError(); return false; } //If there was an error in the optimizing, which shouldn't happen
-			}
-		}
+    #if defined(USE_AOT)
+        m_fromStart = fresh && m_instPtr == 0 && m_dataPtr == m_memory.m_start && m_memory.isZero() && m_preOutput.empty();
+    #endif
 
-		m_program = m_emitter.emit();
+        m_codeCache.setDirectory(fresh ? m_cache.getDirectory() : "");
+
+        CodeCache::Header key = m_codeCache.makeHeader(m_program, process ? optimization : 0, m_numInput,
+                                                       m_memory.m_size, m_memory.m_start, m_memory.m_slack, m_instPtr);
+
+        if(m_codeCache.load(key, m_jit_emitter, m_relocations, m_codeMap)) {
+            m_instPtr = process ? m_program.tokens.size() : m_program.source.size();
+        } else {
+            if(!compile())
+                return false;
+
+            m_codeCache.store(key, m_jit_emitter, m_relocations, m_codeMap);
+        }
 
-		return compile();
+        return loadCode();
     }
 
     bool JITInterpreter::run(float runSpeed) {
-        // for(const auto &byte : m_jit_emitter.getCode()) {
-        //     printf("%0.2X ", byte);
+        // for(std::size_t i = 0; i < m_jit_emitter.size(); i++) {
+        //     printf("%0.2X ", m_jit_emitter.getCode()[i]);
         // }
 
-        m_runtime.loadCode(m_jit_emitter.getCode());
-        JITFunc func = reinterpret_cast<JITFunc>(m_runtime.getMemory());
-        func((uint64_t*)m_memory.m_cells);
+        flushPreRun();
+
+        if(m_code == nullptr) {
+            m_error = "No program is loaded";
+            return false;
+        }
+
+        JITFunc func = reinterpret_cast<JITFunc>(m_code);
+
+    #if defined(USE_GUARD_PAGES)
+        installFaultHandler();
+
+        if(sigsetjmp(m_faultJump, 1) != 0) {
+            running = nullptr;
+            flushOutput();
+
+            return memoryError();
+        }
+
+        running = this;
+    #endif
+
+        //The next program picks up on the cell this one finished on
+        m_dataPtr = func((uint64_t*)(m_memory.m_cells + m_dataPtr), m_memory.m_cells, m_memory.m_cells + m_memory.m_size) - m_memory.m_cells;
+
+    #if defined(USE_GUARD_PAGES)
+        running = nullptr;
+    #endif
+
+        flushOutput();
 
         return true;
     }
 
+#if defined(USE_AOT)
+    bool JITInterpreter::writeExecutable(const std::string &path) {
+        if(m_code == nullptr) {
+            m_error = "No program is loaded";
+            return false;
+        }
+
+        if(m_numInput) {
+            m_error = "Number input can't be compiled into an executable";
+            return false;
+        }
+
+        //The executable starts on a fresh tape, so nothing can have run yet
+        if(!m_fromStart) {
+            m_error = "The program has to be loaded without running any of it to be compiled into an executable";
+            return false;
+        }
+
+        ExecutableOptions options;
+        options.tapeSize = m_memory.m_size;
+        options.start = m_dataPtr;
+        options.eof = m_eofPolicy;
+        options.raw = m_input.isRaw();
+        options.outputBuffer = m_output.getBufferSize();
+        options.inputEnd = static_cast<int32_t>(reinterpret_cast<uintptr_t>(&m_input.m_end) - reinterpret_cast<uintptr_t>(&m_input.m_next));
+        options.outputEnd = static_cast<int32_t>(reinterpret_cast<uintptr_t>(&m_output.m_end) - reinterpret_cast<uintptr_t>(&m_output.m_next));
+
+        return jit::writeExecutable(path, m_jit_emitter, m_relocations, m_program.constants, options, m_error);
+    }
+#endif
+
+#if defined(USE_GUARD_PAGES)
+    //Finds the instruction that went off the tape from where the code faulted, and builds the same message as the other interpreters
+    bool JITInterpreter::memoryError() {
+        std::size_t offset = m_faultAddress - reinterpret_cast<uintptr_t>(m_code);
+        auto instruction = std::upper_bound(m_codeMap.begin(), m_codeMap.end(), std::make_pair(offset, SIZE_MAX));
+
+        m_dataPtr = m_faultCell - reinterpret_cast<uintptr_t>(m_memory.m_cells);
+        m_instPtr = instruction != m_codeMap.begin() ? (instruction - 1)->second : 0;
+
+        m_error = "Out-of-Bounds memory access on instruction '";
+        m_error += m_program[m_instPtr];
+        m_error += "' at character ";
+        m_error += std::to_string(m_instPtr + 1);
+
+        return false;
+    }
+#endif
+
     bool JITInterpreter::step() {
         return false;
     }
 
     bool JITInterpreter::compile() {
-        //This is where the fun begins
+        //This is where the fun begins, the code from the last program is thrown out first
+        m_jit_emitter.clear();
+        m_relocations.clear();
         m_jit_emitter.push_reg(r13);
         m_jit_emitter.push_reg(r14);
         m_jit_emitter.push_reg(r15);
+        m_jit_emitter.push_reg(rbx);
+        m_jit_emitter.push_reg(r12);
+        m_jit_emitter.push_reg(rbp);
+        m_jit_emitter.sub_from_reg(8, rsp); //Keeps the stack aligned for calls
+
+        m_cellLoaded = m_cellDirty = m_cellFlags = false;
+        m_inRange = false;
 
-        m_jit_emitter.movabs(reinterpret_cast<uint64_t>(func_printChar), r14);
-        m_jit_emitter.movabs(reinterpret_cast<uint64_t>(func_getChar), r15);
-        
         #if defined(PLATFORM_WINDOWS)
         m_jit_emitter.mov(rcx, r13);
+        m_jit_emitter.mov(rdx, r15);
+        m_jit_emitter.mov(r8, r14);
         #else
         m_jit_emitter.mov(rdi, r13);
+        m_jit_emitter.mov(rsi, r15);
+        m_jit_emitter.mov(rdx, r14);
         #endif
 
-        std::size_t size = m_program.processed ? m_program.tokens.size() : m_program.source.size();
-        unsigned int label_counter = 0;
-        std::stack<unsigned int> label_stack;
+        m_flushRoutine = m_jit_emitter.newLabel();
+        m_inputRoutine = m_jit_emitter.newLabel();
+        loadOutput();
 
-        while(m_instPtr < size) {
-            if(m_program.processed) {
-                if(!compileInstr(m_program.tokens[m_instPtr], label_counter, label_stack)) { m_jit_emitter.clear(); return false; }
-            } else {
-                if(!compileInstr(m_program.source[m_instPtr], label_counter, label_stack)) { m_jit_emitter.clear(); return false; }
+        std::stack<std::pair<Label, Label>> loops; //Start and end of each loop that's open
+
+        m_codeMap.clear();
+        m_faultStubs.clear();
+
+        if(m_program.processed) {
+            std::vector<Instruction> code;
+            std::vector<std::size_t> origin;
+
+            if(!decode(m_program, code, origin, m_error)) { m_jit_emitter.clear(); return false; }
+
+            //The code starts at the instruction preRun() stopped at
+            std::size_t resume = std::lower_bound(origin.begin(), origin.end(), m_instPtr) - origin.begin();
+            std::size_t depth = 0;
+
+            Label resumeLabel = m_jit_emitter.newLabel();
+
+            if(resume != 0)
+                m_jit_emitter.jmp(resumeLabel);
+
+            for(std::size_t i = 0; i + 1 < code.size(); i++) {
+                if(i == resume) {
+                    dropCell();
+                    m_inRange = false;
+                    m_jit_emitter.bind(resumeLabel);
+                }
+
+                //Anything outside of every loop before the resume point never runs, along with loops that finished
+                if(depth == 0 && i < resume) {
+                    if(code[i].op != OP_START_LOOP)
+                        continue;
+
+                    if(code[i].data < resume) {
+                        i = code[i].data;
+                        continue;
+                    }
+                }
+
+                if(code[i].op == OP_START_LOOP)
+                    depth++;
+                else if(code[i].op == OP_END_LOOP)
+                    depth--;
+
+                m_codeMap.emplace_back(m_jit_emitter.size(), origin[i]);
+                compileInstr(code[i], loops);
             }
 
-            m_instPtr++;
+            if(resume + 1 == code.size()) {
+                dropCell();
+                m_jit_emitter.bind(resumeLabel);
+            }
+
+            m_instPtr = m_program.tokens.size();
+        } else {
+            while(m_instPtr < m_program.source.size()) {
+                m_codeMap.emplace_back(m_jit_emitter.size(), m_instPtr);
+
+                if(!compileInstr(m_program.source[m_instPtr], loops)) { m_jit_emitter.clear(); return false; }
+
+                m_instPtr++;
+            }
         }
 
+        storeCell();
+        storeOutput();
+        m_jit_emitter.mov(r13, rax);
+        m_jit_emitter.add_to_reg(8, rsp);
+        m_jit_emitter.pop_reg(rbp);
+        m_jit_emitter.pop_reg(r12);
+        m_jit_emitter.pop_reg(rbx);
         m_jit_emitter.pop_reg(r15);
         m_jit_emitter.pop_reg(r14);
         m_jit_emitter.pop_reg(r13);
         m_jit_emitter.ret();
 
+        compileFaultStubs();
+        compileRoutines();
+
         if(!m_jit_emitter.resolveLabels()) {
             m_jit_emitter.clear();
             m_error = "Failed to resolve labels";
@@ -110,124 +325,527 @@ namespace jit {
         return true;
     }
 
-    bool JITInterpreter::compileInstr(Token instr, unsigned int &label_counter, std::stack<unsigned int> &label_stack) {
-        switch(instr.identifier) {
-            case SHIFT_RIGHT : m_jit_emitter.add_to_reg(instr.data, r13);
+    //Fills in the addresses for this instance and process, then copies the code in the emitter to where it can run
+    bool JITInterpreter::loadCode() {
+        for(const Relocation &relocation : m_relocations)
+            m_jit_emitter.patchInt(relocation.location, relocationBase(relocation.kind) + relocation.addend);
+
+        m_code = m_runtime.loadCode(m_jit_emitter.getCode(), m_jit_emitter.size());
+
+        if(m_code == nullptr) {
+            m_error = "Out of memory for compiled code";
+            return false;
+        }
+
+        return true;
+    }
+
+    //Where each kind of address the code uses is in this process
+    uint64_t JITInterpreter::relocationBase(uint32_t kind) {
+        switch(kind) {
+            case RELOC_INSTANCE : return reinterpret_cast<uint64_t>(this);
+            case RELOC_INPUT : return reinterpret_cast<uint64_t>(&m_input.m_next);
+            case RELOC_OUTPUT : return reinterpret_cast<uint64_t>(&m_output.m_next);
+            case RELOC_CONSTANTS : return reinterpret_cast<uint64_t>(m_program.constants.data());
+            case RELOC_FLUSH : return reinterpret_cast<uint64_t>(func_flushOutput);
+            case RELOC_GET_CHAR : return reinterpret_cast<uint64_t>(func_getChar);
+            case RELOC_PRINT : return reinterpret_cast<uint64_t>(func_print);
+            default : return 0;
+        }
+    }
+
+    //Loads an address with movabs, and keeps where it went so it can be filled in again when the code comes from the cache
+    void JITInterpreter::emitAddress(RELOCATION_KIND kind, uint64_t addend, x64GPRegister reg) {
+        m_jit_emitter.movabs(relocationBase(kind) + addend, reg);
+        m_relocations.push_back(Relocation{kind, static_cast<uint32_t>(m_jit_emitter.size() - 8), addend});
+    }
+
+    /**
+     * Compiles a decoded instruction, the labels of each loop are kept on a stack until it closes.
+     *
+     * @param loops Start and end labels of the loops the instruction is in
+     */
+    void JITInterpreter::compileInstr(const Instruction &instr, std::stack<std::pair<Label, Label>> &loops) {
+        switch(instr.op) {
+            case OP_SHIFT_RIGHT :
+                dropCell();
+                m_jit_emitter.add_to_reg(instr.data, r13);
+                m_lowest -= instr.data;
+                m_highest -= instr.data;
             break;
-            case SHIFT_LEFT : m_jit_emitter.sub_from_reg(instr.data, r13);
+            case OP_SHIFT_LEFT :
+                dropCell();
+                m_jit_emitter.sub_from_reg(instr.data, r13);
+                m_lowest += instr.data;
+                m_highest += instr.data;
             break;
-            case INCREMENT : m_jit_emitter.addb_at_reg(instr.data, r13);
+            case OP_INCREMENT :
+                if(instr.offset == 0) {
+                    loadCell();
+                    m_jit_emitter.addb_reg(instr.data, rbx);
+                    m_cellDirty = m_cellFlags = true;
+                } else {
+                    checkCell(instr.offset);
+                    m_jit_emitter.addb_at_reg(instr.data, r13, instr.offset);
+                    m_cellFlags = false;
+                }
             break;
-            case DECREMENT : m_jit_emitter.subb_at_reg(instr.data, r13);
+            case OP_DECREMENT :
+                if(instr.offset == 0) {
+                    loadCell();
+                    m_jit_emitter.subb_reg(instr.data, rbx);
+                    m_cellDirty = m_cellFlags = true;
+                } else {
+                    checkCell(instr.offset);
+                    m_jit_emitter.subb_at_reg(instr.data, r13, instr.offset);
+                    m_cellFlags = false;
+                }
             break;
-            case START_LOOP :
-                label_stack.push(label_counter);
-
-                m_jit_emitter.cmpb_at_reg(0, r13);
-                m_jit_emitter.jz(std::string("end_") + std::to_string(label_counter));
-                m_jit_emitter.emitLabel(std::string("start_") + std::to_string(label_counter));
-
-                label_counter++;
+            case OP_START_LOOP : compileLoop(true, loops);
             break;
-            case END_LOOP :
-                if(label_stack.empty()) {
-                    m_error = std::string("Missing open loop at ") + std::to_string(m_instPtr);
-                    return false;
-                }
-
-                m_jit_emitter.cmpb_at_reg(0, r13);
-                m_jit_emitter.jnz(std::string("start_") + std::to_string(label_stack.top()));
-                m_jit_emitter.emitLabel(std::string("end_") + std::to_string(label_stack.top()));
-
-                label_stack.pop();
+            case OP_END_LOOP : compileLoop(false, loops);
+            break;
+            case OP_INPUT : compileInput(instr.offset);
+            break;
+            case OP_OUTPUT : compileOutput(instr.offset);
             break;
-            case INPUT :
-                //Move a pointer to this instance into rdi for the System V ABI, and rcx for the Windows ABI
+            case OP_PRINT :
+                //The string is in m_program, which stays around as long as the code does
+                storeOutput();
+
                 #if defined(PLATFORM_WINDOWS)
-                    m_jit_emitter.movabs(reinterpret_cast<uint64_t>(this), rcx);
+                    emitAddress(RELOC_INSTANCE, 0, rcx);
+                    emitAddress(RELOC_CONSTANTS, instr.data, rdx);
+                    m_jit_emitter.mov(static_cast<uint32_t>(instr.offset), r8);
                 #else
-                    m_jit_emitter.movabs(reinterpret_cast<uint64_t>(this), rdi);
+                    emitAddress(RELOC_INSTANCE, 0, rdi);
+                    emitAddress(RELOC_CONSTANTS, instr.data, rsi);
+                    m_jit_emitter.mov(static_cast<uint32_t>(instr.offset), rdx);
                 #endif
 
-                m_jit_emitter.call_at_reg(r15);
-                m_jit_emitter.mov_al_at_reg(r13);
+                emitAddress(RELOC_PRINT, 0, rax);
+                m_jit_emitter.call_at_reg(rax);
+                loadOutput();
+                m_cellFlags = false;
             break;
-            case OUTPUT :
-                #if defined(PLATFORM_WINDOWS)
-                    m_jit_emitter.mov(r13, rcx);
-                #else
-                    m_jit_emitter.mov(r13, rdi);
-                #endif
+            case OP_CLEAR :
+            case OP_SET :
+                //A mov leaves the flags alone, so setting another cell doesn't lose them. The current cell only goes in rbx
+                checkCell(instr.offset, instr.offset != 0);
+
+                if(instr.offset == 0) {
+                    m_jit_emitter.movb_reg(instr.op == OP_SET ? instr.data : 0, rbx);
+                    m_cellLoaded = m_cellDirty = true;
+                    m_cellFlags = false;
+                } else {
+                    m_jit_emitter.mov_at_reg(instr.op == OP_SET ? instr.data : 0, r13, instr.offset);
+                }
+            break;
+            case OP_MULTIPLY :
+                //Add the current cell times the factor to the cell at the offset, only the low byte matters
+                if(instr.offset == 0) {
+                    dropCell();
+                    checkCell(0);
+                    m_jit_emitter.movzxb_at_reg(r13, rax);
+                } else {
+                    loadCell();
+                    m_jit_emitter.movzxb_reg(rbx, rax);
+                }
 
-                m_jit_emitter.call_at_reg(r14);
+                m_cellFlags = false;
+
+                if(instr.data != 1 && instr.data != 255)
+                    m_jit_emitter.imul(static_cast<int8_t>(instr.data), rax); //Only the low byte matters so it always fits in an imm8
+
+                if(instr.offset == 0) {
+                    if(instr.data == 255)
+                        m_jit_emitter.subb_reg_at_reg(rax, r13);
+                    else
+                        m_jit_emitter.addb_reg_at_reg(rax, r13);
+                } else {
+                    //The loop this came from didn't touch the other cell when the current one was zero, so it's only an error otherwise.
+                    //A cell that isn't known to be on the tape is checked first, and the stub skips the add when bl is zero.
+                    Label skip = m_jit_emitter.newLabel();
+
+                    if(!(m_inRange && instr.offset >= m_lowest && instr.offset <= m_highest)) {
+                        m_jit_emitter.lea(r13, instr.offset, rdx);
+
+                        if(instr.offset < 0) {
+                            m_jit_emitter.cmp(r15, rdx);
+                            m_jit_emitter.jb(faultStub(true, skip));
+                        } else {
+                            m_jit_emitter.cmp(r14, rdx);
+                            m_jit_emitter.jae(faultStub(true, skip));
+                        }
+                    }
+
+                    if(instr.data == 255)
+                        m_jit_emitter.subb_reg_at_reg(rax, r13, instr.offset);
+                    else
+                        m_jit_emitter.addb_reg_at_reg(rax, r13, instr.offset);
+
+                    m_jit_emitter.bind(skip);
+                }
             break;
-            case CLEAR : m_jit_emitter.mov_at_reg(0, r13);
+            case OP_SCAN_RIGHT :
+                dropCell();
+                compileScan(true, instr.data);
             break;
-            case COPY : 
-                //Move the value in the current cell to the next two, then clear the current cell
-                m_jit_emitter.mov_at_reg(r13, rax);
-                m_jit_emitter.inc(r13);
-                m_jit_emitter.mov_al_at_reg(r13);
-                m_jit_emitter.inc(r13);
-                m_jit_emitter.mov_al_at_reg(r13);
-                m_jit_emitter.sub_from_reg(2, r13);
-                m_jit_emitter.mov_at_reg(0, r13);
+            case OP_SCAN_LEFT :
+                dropCell();
+                compileScan(false, instr.data);
             break;
+            default : break;
         }
+    }
 
-        return true;
+    /**
+     * Takes a byte straight from the input buffer into the cell at the offset, and only calls the input routine when the
+     * buffer is empty. Number input has to go through getChar() every time, since it can take more than one byte.
+     */
+    void JITInterpreter::compileInput(int32_t offset) {
+        Label empty = m_jit_emitter.newLabel();
+        Label done = m_jit_emitter.newLabel();
+        int32_t end = reinterpret_cast<const char*>(&m_input.m_end) - reinterpret_cast<const char*>(&m_input.m_next);
+
+        //The current cell doesn't come from the tape when there's input in the buffer
+        checkCell(offset, offset != 0 || m_cellLoaded || m_numInput);
+
+        if(!m_numInput) {
+            emitAddress(RELOC_INPUT, 0, rcx);
+            m_jit_emitter.movq_at_reg(rcx, rdx);
+            m_jit_emitter.movq_at_reg(rcx, rax, end);
+            m_jit_emitter.cmp(rdx, rax);
+            m_jit_emitter.jz(empty);
+            m_jit_emitter.movzxb_at_reg(rdx, rax);
+            m_jit_emitter.inc(rdx);
+            m_jit_emitter.movq_reg_at_reg(rdx, rcx);
+            m_jit_emitter.jmp(done);
+            m_jit_emitter.bind(empty);
+        }
+
+        //getChar() takes the cell as its second argument, for the System V ABI and the Windows ABI
+        #if defined(PLATFORM_WINDOWS)
+            x64GPRegister current = rdx;
+        #else
+            x64GPRegister current = rsi;
+        #endif
+
+        if(offset == 0 && m_cellLoaded)
+            m_jit_emitter.movzxb_reg(rbx, current);
+        else
+            m_jit_emitter.movzxb_at_reg(r13, current, offset);
+
+        m_jit_emitter.call(m_inputRoutine);
+        m_jit_emitter.bind(done);
+
+        //Both ways leave the byte in al
+        if(offset == 0) {
+            m_jit_emitter.movzxb_reg(rax, rbx);
+            m_cellLoaded = m_cellDirty = true;
+        } else {
+            m_jit_emitter.mov_al_at_reg(r13, offset);
+        }
+
+        m_cellFlags = false;
+    }
+
+    //Puts the cell at the offset straight into the output buffer at r12, and only calls the flush routine when that fills it up
+    void JITInterpreter::compileOutput(int32_t offset) {
+        Label done = m_jit_emitter.newLabel();
+
+        checkCell(offset);
+
+        if(offset == 0 && m_cellLoaded) {
+            m_jit_emitter.movb_reg_at_reg(rbx, r12);
+        } else {
+            m_jit_emitter.movzxb_at_reg(r13, rax, offset);
+            m_jit_emitter.mov_al_at_reg(r12);
+        }
+
+        m_jit_emitter.inc(r12);
+        m_jit_emitter.cmp(rbp, r12);
+        m_jit_emitter.jnz(done);
+        m_jit_emitter.call(m_flushRoutine);
+        m_jit_emitter.bind(done);
+
+        m_cellFlags = false;
+    }
+
+    //The slow paths of input and output, after the program so they're out of the way. They're called from the program, so
+    //the stack is 8 bytes off, and the buffer pointers go back to m_output for the call and are picked up again after it.
+    void JITInterpreter::compileRoutines() {
+        for(Label routine : {m_flushRoutine, m_inputRoutine}) {
+            m_jit_emitter.bind(routine);
+            m_jit_emitter.sub_from_reg(8, rsp);
+            storeOutput();
+
+            #if defined(PLATFORM_WINDOWS)
+                emitAddress(RELOC_INSTANCE, 0, rcx);
+            #else
+                emitAddress(RELOC_INSTANCE, 0, rdi);
+            #endif
+
+            emitAddress(routine == m_flushRoutine ? RELOC_FLUSH : RELOC_GET_CHAR, 0, rax);
+            m_jit_emitter.call_at_reg(rax);
+            loadOutput(); //Leaves rax alone, which has the byte from getChar()
+            m_jit_emitter.add_to_reg(8, rsp);
+            m_jit_emitter.ret();
+        }
+    }
+
+    //Puts m_output's next and end pointers in r12 and rbp
+    void JITInterpreter::loadOutput() {
+        int32_t end = reinterpret_cast<const char*>(&m_output.m_end) - reinterpret_cast<const char*>(&m_output.m_next);
+
+        emitAddress(RELOC_OUTPUT, 0, rcx);
+        m_jit_emitter.movq_at_reg(rcx, r12);
+        m_jit_emitter.movq_at_reg(rcx, rbp, end);
+    }
+
+    //Writes r12 back to m_output, so the functions the code calls see what it's put in the buffer
+    void JITInterpreter::storeOutput() {
+        emitAddress(RELOC_OUTPUT, 0, rcx);
+        m_jit_emitter.movq_reg_at_reg(r12, rcx);
+    }
+
+    //Tests the cell in bl, which the tape has to have at both edges of the loop since either can be jumped to
+    void JITInterpreter::compileLoop(bool start, std::stack<std::pair<Label, Label>> &loops) {
+        loadCell();
+        storeCell();
+
+        if(!m_cellFlags)
+            m_jit_emitter.testb(rbx, rbx);
+
+        if(start) {
+            loops.emplace(m_jit_emitter.newLabel(), m_jit_emitter.newLabel());
+
+            m_jit_emitter.jz(loops.top().second);
+            m_jit_emitter.bind(loops.top().first);
+        } else {
+            m_jit_emitter.jnz(loops.top().first);
+            m_jit_emitter.bind(loops.top().second);
+
+            loops.pop();
+        }
+
+        //Every jump to either label comes from a test of bl, so the zero flag is still from it, and it's the only cell known to be on the tape
+        m_cellFlags = true;
+        m_inRange = true;
+        m_lowest = m_highest = 0;
     }
 
-    bool JITInterpreter::compileInstr(char instr, unsigned int &label_counter, std::stack<unsigned int> &label_stack) {
+    //Puts the cell in rbx if it isn't there already
+    void JITInterpreter::loadCell() {
+        if(!m_cellLoaded) {
+            checkCell(0);
+            m_jit_emitter.movzxb_at_reg(r13, rbx);
+            m_cellLoaded = true;
+        }
+    }
+
+    //Writes changes to the cell back to the tape, it stays in rbx
+    void JITInterpreter::storeCell() {
+        if(m_cellDirty) {
+            m_jit_emitter.movb_reg_at_reg(rbx, r13);
+            m_cellDirty = false;
+        }
+    }
+
+    //Writes the cell back and forgets it, for when r13 moves
+    void JITInterpreter::dropCell() {
+        storeCell();
+        m_cellLoaded = m_cellFlags = false;
+    }
+
+    //Makes sure the cell at the offset is before the end of the tape, when the tape has slack the guard page doesn't catch.
+    //The low end isn't checked, the first cell is right after the low guard and the guard is bigger than any offset an
+    //instruction can have, so going off it faults unless r13 moves a whole guard past it without touching a cell. A cell in
+    //rbx was checked when it got there.
+    //When the instruction won't touch the cell on the tape, because it only goes in rbx, the cell is touched here instead,
+    //so it still faults on the guards.
+    void JITInterpreter::checkCell(int32_t offset, bool accessed) {
+        bool known = (offset == 0 && m_cellLoaded) || (m_inRange && offset <= m_highest);
+
+        if(!accessed && !(offset == 0 && m_cellLoaded) && !(m_inRange && offset >= m_lowest && offset <= m_highest)) {
+            m_jit_emitter.cmpb_at_reg(0, r13, offset);
+            m_cellFlags = false;
+        }
+
+        if(m_memory.m_slack != 0 && !known) {
+            if(offset == 0) {
+                compileEndCheck(r13);
+            } else {
+                m_jit_emitter.lea(r13, offset, rax);
+                compileEndCheck(rax);
+            }
+
+            m_cellFlags = false;
+        }
+
+        //The code after the access only runs if it didn't fault, so the cell is on the tape then
+        if(!m_inRange) {
+            m_inRange = true;
+            m_lowest = m_highest = offset;
+        } else {
+            m_lowest = std::min<int64_t>(m_lowest, offset);
+            m_highest = std::max<int64_t>(m_highest, offset);
+        }
+    }
+
+    //Goes to a fault stub if the address in the register is at r14 or past it
+    void JITInterpreter::compileEndCheck(x64GPRegister address) {
+        m_jit_emitter.cmp(r14, address);
+        m_jit_emitter.jae(faultStub());
+    }
+
+    //Makes a stub for the instruction being compiled, and returns the label to jump to it
+    Label JITInterpreter::faultStub(bool conditional, Label skip) {
+        Label entry = m_jit_emitter.newLabel();
+
+        m_faultStubs.push_back(FaultStub{entry, skip, conditional, m_codeMap.back().second});
+
+        return entry;
+    }
+
+    //Each stub gets its own entry in the code map, so the handler finds the instruction from where it faulted in the high guard
+    void JITInterpreter::compileFaultStubs() {
+        for(const FaultStub &stub : m_faultStubs) {
+            m_jit_emitter.bind(stub.entry);
+            m_codeMap.emplace_back(m_jit_emitter.size(), stub.instruction);
+
+            if(stub.conditional) {
+                m_jit_emitter.testb(rbx, rbx);
+                m_jit_emitter.jz(stub.skip);
+            }
+
+            m_jit_emitter.cmpb_at_reg(0, r14, Tape::GUARD_SIZE / 2);
+        }
+    }
+
+    //Moves r13 to the nearest zero cell in steps of stride, checking 16 cells at a time with SSE2 when the stride divides 16
+    //and one step at a time otherwise. Blocks are only loaded while they're inside of the tape, the steps finish the last few cells.
+    void JITInterpreter::compileScan(bool right, unsigned int stride) {
+        Label step = m_jit_emitter.newLabel();
+        Label found = m_jit_emitter.newLabel();
+
+        //Going left can only reach the slack from where it starts
+        if(!right)
+            checkCell(0);
+
+        if(16 % stride == 0) {
+            Label block = m_jit_emitter.newLabel();
+            Label inBlock = m_jit_emitter.newLabel();
+
+            //The bytes of each block the stride lands on, blocks going left end at r13 so they start from the top
+            uint32_t mask = 0;
+
+            for(unsigned int bit = 0; bit < 16; bit += stride)
+                mask |= 1 << (right ? bit : 15 - bit);
+
+            m_jit_emitter.pxor(xmm1, xmm1);
+            m_jit_emitter.bind(block);
+
+            if(right) {
+                m_jit_emitter.lea(r13, 16, rax);
+                m_jit_emitter.cmp(r14, rax);
+                m_jit_emitter.ja(step);
+            } else {
+                m_jit_emitter.lea(r13, -15, rax);
+                m_jit_emitter.cmp(r15, rax);
+                m_jit_emitter.jb(step);
+            }
+
+            m_jit_emitter.movdqu_at_reg(r13, xmm0, right ? 0 : -15);
+            m_jit_emitter.pcmpeqb(xmm1, xmm0);
+            m_jit_emitter.pmovmskb(xmm0, rax);
+
+            if(stride == 1)
+                m_jit_emitter.test(rax, rax);
+            else
+                m_jit_emitter.and_reg(mask, rax);
+
+            m_jit_emitter.jnz(inBlock);
+
+            if(right)
+                m_jit_emitter.add_to_reg(16, r13);
+            else
+                m_jit_emitter.sub_from_reg(16, r13);
+
+            m_jit_emitter.jmp(block);
+            m_jit_emitter.bind(inBlock);
+
+            if(right) {
+                m_jit_emitter.bsf(rax, rax);
+                m_jit_emitter.add_to_reg(rax, r13);
+            } else {
+                m_jit_emitter.bsr(rax, rax);
+                m_jit_emitter.sub_from_reg(15, r13);
+                m_jit_emitter.add_to_reg(rax, r13);
+            }
+
+            m_jit_emitter.jmp(found);
+        }
+
+        //Going left runs into the low guard by itself, going right only does when there's no slack
+        m_jit_emitter.bind(step);
+
+        if(right && m_memory.m_slack != 0)
+            compileEndCheck(r13);
+
+        m_jit_emitter.cmpb_at_reg(0, r13);
+        m_jit_emitter.jz(found);
+
+        if(right)
+            m_jit_emitter.add_to_reg(stride, r13);
+        else
+            m_jit_emitter.sub_from_reg(stride, r13);
+
+        m_jit_emitter.jmp(step);
+        m_jit_emitter.bind(found);
+
+        //It stopped on a cell it read
+        m_inRange = true;
+        m_lowest = m_highest = 0;
+    }
+
+    bool JITInterpreter::compileInstr(char instr, std::stack<std::pair<Label, Label>> &loops) {
         switch(instr) {
-            case SHIFT_RIGHT : m_jit_emitter.inc(r13);
+            case SHIFT_RIGHT :
+                dropCell();
+                m_jit_emitter.inc(r13);
+                m_lowest--;
+                m_highest--;
             break;
-            case SHIFT_LEFT : m_jit_emitter.dec(r13);
+            case SHIFT_LEFT :
+                dropCell();
+                m_jit_emitter.dec(r13);
+                m_lowest++;
+                m_highest++;
             break;
-            case INCREMENT : m_jit_emitter.addb_at_reg(1, r13);
+            case INCREMENT :
+                loadCell();
+                m_jit_emitter.addb_reg(1, rbx);
+                m_cellDirty = m_cellFlags = true;
             break;
-            case DECREMENT : m_jit_emitter.subb_at_reg(1, r13);
+            case DECREMENT :
+                loadCell();
+                m_jit_emitter.subb_reg(1, rbx);
+                m_cellDirty = m_cellFlags = true;
             break;
-            case START_LOOP :
-                label_stack.push(label_counter);
-
-                m_jit_emitter.cmpb_at_reg(0, r13);
-                m_jit_emitter.jz(std::string("end_") + std::to_string(label_counter));
-                m_jit_emitter.emitLabel(std::string("start_") + std::to_string(label_counter));
-
-                label_counter++;
+            case START_LOOP : compileLoop(true, loops);
             break;
             case END_LOOP : 
-                if(label_stack.empty()) {
+                if(loops.empty()) {
                     m_error = std::string("Missing open loop at ") + std::to_string(m_instPtr);
                     return false;
                 }
 
-                m_jit_emitter.cmpb_at_reg(0, r13);
-                m_jit_emitter.jnz(std::string("start_") + std::to_string(label_stack.top()));
-                m_jit_emitter.emitLabel(std::string("end_") + std::to_string(label_stack.top()));
-
-                label_stack.pop();
+                compileLoop(false, loops);
             break;
-            case INPUT :
-                //Move a pointer to this instance into rdi for the System V ABI, and rcx for the Windows ABI
-                #if defined(PLATFORM_WINDOWS)
-                    m_jit_emitter.movabs(reinterpret_cast<uint64_t>(this), rcx);
-                #else
-                    m_jit_emitter.movabs(reinterpret_cast<uint64_t>(this), rdi);
-                #endif
-
-                m_jit_emitter.call_at_reg(r15);
-                m_jit_emitter.mov_al_at_reg(r13);
+            case INPUT : compileInput(0);
             break;
-            case OUTPUT :
-                #if defined(PLATFORM_WINDOWS)
-                    m_jit_emitter.mov(r13, rcx);
-                #else
-                    m_jit_emitter.mov(r13, rdi);
-                #endif
-
-                m_jit_emitter.call_at_reg(r14);
+            case OUTPUT : compileOutput(0);
             break;
         }
 
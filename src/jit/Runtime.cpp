@@ -4,98 +4,205 @@
 
 #include "jit/Runtime.hpp"
 
-#include <cassert>
 #include <cstring>
 #include <cstdio>
+#include <iterator>
 
 #include "jit/Platform.hpp"
 
+#if defined(USE_DUAL_MAPPING)
+#include <fcntl.h>
+#endif
+
 namespace bs {
 
 namespace jit {
 
     //--------------- JIT Runtime class methods ---------------//
 
-    JITRuntime::JITRuntime() : m_isExecutable(false) {
-        createBuffer();
-    }
-
-    JITRuntime::~JITRuntime() {
-        freeBuffer();
-    }
-
-    //No execution permission because buffers allocated this way cannot have execution and write privelages
-    //at the same time, so another function will adjust the permissions later.
-    void JITRuntime::createBuffer() {
+    //The file is as big as the cache from the start, but it's sparse so it only takes memory for what's written
+    JITRuntime::JITRuntime() {
     #if defined(PLATFORM_WINDOWS)
         SYSTEM_INFO si;
         GetSystemInfo(&si);
         m_page_size = si.dwPageSize;
-        m_mem_size = m_page_size * 2;
-        m_memory = (uint8_t*)VirtualAlloc(nullptr, si.dwPageSize * 2, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
     #else
-        long page_size = sysconf(_SC_PAGESIZE);
-        m_page_size = page_size;
-        m_mem_size = m_page_size * 2;
-        m_memory = (uint8_t*)mmap(nullptr, page_size * 2, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        m_page_size = sysconf(_SC_PAGESIZE);
     #endif
-        assert(m_memory != nullptr);
-    }
 
-    void JITRuntime::freeBuffer() {
-        assert(m_memory != nullptr);
+    #if defined(USE_DUAL_MAPPING)
+        //Anything that fails here leaves the runtime giving each piece of code its own pages instead
+        m_file = memfd_create("bsi-code", MFD_CLOEXEC);
 
-    #if defined(PLATFORM_WINDOWS)
-        VirtualFree(m_memory, 0, MEM_RELEASE);
-    #else
-        munmap(m_memory, m_mem_size);
+        if(m_file >= 0 && ftruncate(m_file, CACHE_SIZE) == 0) {
+            void *writable = mmap(nullptr, CACHE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, m_file, 0);
+            void *executable = mmap(nullptr, CACHE_SIZE, PROT_READ | PROT_EXEC, MAP_SHARED | MAP_NORESERVE, m_file, 0);
+
+            if(writable != MAP_FAILED && executable != MAP_FAILED) {
+                m_writable = static_cast<uint8_t*>(writable);
+                m_executable = static_cast<uint8_t*>(executable);
+                return;
+            }
+
+            if(writable != MAP_FAILED)
+                munmap(writable, CACHE_SIZE);
+
+            if(executable != MAP_FAILED)
+                munmap(executable, CACHE_SIZE);
+        }
+
+        if(m_file >= 0)
+            close(m_file);
+
+        m_file = -1;
     #endif
+    }
 
-        m_mem_size = 0;
+    JITRuntime::~JITRuntime() {
+    #if defined(USE_DUAL_MAPPING)
+        if(m_executable != nullptr) {
+            munmap(m_writable, CACHE_SIZE);
+            munmap(m_executable, CACHE_SIZE);
+            close(m_file);
+            return;
+        }
+    #endif
+
+        while(!m_blocks.empty())
+            freeCode(reinterpret_cast<void*>(m_blocks.begin()->first));
     }
 
-    void JITRuntime::protectBuffer() {
-    #if defined(PLATFORM_WINDOWS)
-        DWORD old;
-        VirtualProtect(m_memory, m_mem_size, PAGE_EXECUTE_READ, &old);
-    #else
-        mprotect(m_memory, m_mem_size, PROT_READ | PROT_EXEC);
+    void* JITRuntime::loadCode(const uint8_t *code, std::size_t size) {
+    #if defined(USE_DUAL_MAPPING)
+        if(m_executable != nullptr) {
+            std::size_t space = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+            std::size_t offset = allocate(space);
+
+            if(offset == CACHE_SIZE)
+                return nullptr;
+
+            memcpy(m_writable + offset, code, size);
+            m_blocks[reinterpret_cast<uintptr_t>(m_executable + offset)] = space;
+
+            return m_executable + offset;
+        }
     #endif
 
-        m_isExecutable = true;
+        //No execution permission at first because buffers allocated this way cannot have execution and write privelages
+        //at the same time, so it's changed after the code is copied in
+        std::size_t space = (size + m_page_size - 1) / m_page_size * m_page_size;
+
+        #if defined(PLATFORM_WINDOWS)
+            uint8_t *memory = (uint8_t*)VirtualAlloc(nullptr, space, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+
+            if(memory == nullptr)
+                return nullptr;
+
+            memcpy(memory, code, size);
+
+            DWORD old;
+
+            if(!VirtualProtect(memory, space, PAGE_EXECUTE_READ, &old)) {
+                VirtualFree(memory, 0, MEM_RELEASE);
+                return nullptr;
+            }
+        #else
+            uint8_t *memory = (uint8_t*)mmap(nullptr, space, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+
+            if(memory == MAP_FAILED)
+                return nullptr;
+
+            memcpy(memory, code, size);
+
+            if(mprotect(memory, space, PROT_READ | PROT_EXEC) != 0) {
+                munmap(memory, space);
+                return nullptr;
+            }
+        #endif
+
+        m_blocks[reinterpret_cast<uintptr_t>(memory)] = space;
+
+        return memory;
     }
 
-    void JITRuntime::resizeBuffer(size_t pages) {
-        freeBuffer();
+    void JITRuntime::freeCode(void *code) {
+        auto block = m_blocks.find(reinterpret_cast<uintptr_t>(code));
 
-        m_isExecutable = false;
-        m_mem_size = m_page_size * pages;
-    #if defined(PLATFORM_WINDOWS)
-        m_memory = (uint8_t*)VirtualAlloc(nullptr, m_mem_size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        if(block == m_blocks.end())
+            return;
+
+    #if defined(USE_DUAL_MAPPING)
+        if(m_executable != nullptr)
+            release(static_cast<uint8_t*>(code) - m_executable, block->second);
+        else
+            munmap(code, block->second);
+    #elif defined(PLATFORM_WINDOWS)
+        VirtualFree(code, 0, MEM_RELEASE);
     #else
-        m_memory = (uint8_t*)mmap(nullptr, m_mem_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        munmap(code, block->second);
     #endif
-        assert(m_memory != nullptr);
+
+        m_blocks.erase(block);
     }
 
-    void JITRuntime::loadCode(const std::vector<uint8_t> &code) {
-        //Make sure code can fit into the buffer
-        if(code.size() > m_mem_size) {
-            //Make sure the amount of pages allocated is not truncated below the needed amount
-            resizeBuffer((code.size() / m_page_size) + 1); 
+#if defined(USE_DUAL_MAPPING)
+    //Takes the first freed space big enough, or space that was never used, CACHE_SIZE if neither is left
+    std::size_t JITRuntime::allocate(std::size_t size) {
+        for(auto free = m_free.begin(); free != m_free.end(); ++free) {
+            if(free->second < size)
+                continue;
+
+            std::size_t offset = free->first;
+            std::size_t left = free->second - size;
+
+            m_free.erase(free);
+
+            if(left != 0)
+                m_free[offset + size] = left;
+
+            return offset;
         }
 
-        memcpy(m_memory, code.data(), code.size());
-        protectBuffer();
-    }
+        if(size > CACHE_SIZE - m_used)
+            return CACHE_SIZE;
 
-    void* JITRuntime::getMemory() {
-        return m_memory;
+        m_used += size;
+
+        return m_used - size;
     }
 
-    bool JITRuntime::isExecutable() {
-        return m_isExecutable;
+    //Merges the space with the freed space around it, the pages it covers completely are given back to the system
+    void JITRuntime::release(std::size_t offset, std::size_t size) {
+        auto next = m_free.lower_bound(offset);
+
+        if(next != m_free.end() && offset + size == next->first) {
+            size += next->second;
+            next = m_free.erase(next);
+        }
+
+        if(next != m_free.begin()) {
+            auto previous = std::prev(next);
+
+            if(previous->first + previous->second == offset) {
+                offset = previous->first;
+                size += previous->second;
+                m_free.erase(previous);
+            }
+        }
+
+        //Space at the end goes back to never being used
+        if(offset + size == m_used)
+            m_used = offset;
+        else
+            m_free[offset] = size;
+
+        std::size_t first = (offset + m_page_size - 1) / m_page_size * m_page_size;
+        std::size_t last = (offset + size) / m_page_size * m_page_size;
+
+        if(first < last)
+            fallocate(m_file, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, first, last - first);
     }
+#endif
 
 } //namespace jit
 
@@ -15,6 +15,7 @@
 
 #include "config.hpp"
 #include "Interpreter.hpp"
+#include "ThreadedInterpreter.hpp"
 
 #if defined(USE_JIT)
 #include "jit/JITInterpreter.hpp"
@@ -39,13 +40,22 @@ static std::unordered_map<std::string, int> strToNum = {
 	{"n", 8},                  //Number input, convert digits in input to numbers instead of ascii
 	{"-norun", 9},             //Don't execute the program just print processed program
 #if defined(USE_JIT)
-	{"j",  10}                 //Use the jit interpreter instead of the basic one
+	{"j",  10},                //Use the jit interpreter instead of the basic one
 #endif
+	{"t",  11},                //Use the threaded interpreter instead of the basic one
+	{"-passes", 12},           //Print how long each optimization pass took and what it removed
+	{"-unbuffered", 13},       //Write output as soon as it's printed instead of buffering it
+	{"-grow", 14},             //Use a tape that grows in both directions instead of 30000 cells
+	{"-sparse", 15},           //Use a tape made of pages that are only allocated when they're touched
+	{"-raw", 16}               //Read input as raw bytes instead of a line at a time
 };
 
 static struct {
-	bool flags[11] = {false};
+	bool flags[17] = {false};
 	std::string path = "";
+	std::string cacheDir = ""; //--cache=DIR where optimized and compiled programs are kept
+	std::string aotPath = ""; //--aot=FILE where the compiled program is written as an executable
+	bs::EOF_POLICY eof = bs::EOF_UNCHANGED; //--eof=0, --eof=-1 or --eof=same what input sets cells to after it ends
 	bool repl = true;
 } options;
 
@@ -74,7 +84,30 @@ void parseArgs(int argc, char *argv[]) {
 
 	//Go through args for flags and the source file path
 	for(size_t i = 1; i < argc; i++) {
-		if(argv[i][0] == '-') {
+		if(std::string(argv[i]).rfind("--cache=", 0) == 0) {
+			options.cacheDir = std::string(argv[i]).substr(8);
+		} else if(std::string(argv[i]).rfind("--aot=", 0) == 0) {
+		#if defined(USE_AOT)
+			options.aotPath = std::string(argv[i]).substr(6);
+		#else
+			//Without it the program would just run, instead of being written out
+			std::cout << "Error: " << argv[i] << " is not supported on this platform." << std::endl;
+			exit(1);
+		#endif
+		} else if(std::string(argv[i]).rfind("--eof=", 0) == 0) {
+			std::string policy = std::string(argv[i]).substr(6);
+
+			if(policy == "0") {
+				options.eof = bs::EOF_ZERO;
+			} else if(policy == "-1") {
+				options.eof = bs::EOF_MINUS_ONE;
+			} else if(policy == "same") {
+				options.eof = bs::EOF_UNCHANGED;
+			} else {
+				std::cout << "Error: " << argv[i] << " is not a valid option." << std::endl;
+				exit(1);
+			}
+		} else if(argv[i][0] == '-') {
 			if(!isOption(std::string(argv[i]).substr(1))) {
 				std::cout << "Error: " << argv[i] << " is not a valid option." << std::endl;
 				exit(1);
@@ -91,6 +124,12 @@ void parseArgs(int argc, char *argv[]) {
 	}
 
 	if(options.flags[strToNum["O1"]] || options.flags[strToNum["O2"]]) { options.flags[2] = true; }
+
+	//The JIT addresses the cells straight from a register, so they have to be in one block
+	if((options.flags[10] || !options.aotPath.empty()) && options.flags[15]) {
+		std::cout << "Error: --sparse can't be used with the JIT or --aot." << std::endl;
+		exit(1);
+	}
 }
 
 
@@ -190,8 +229,13 @@ void printInfo(std::shared_ptr<bs::Interpreter> interpreter, std::chrono::micros
 		std::cout << "Program: ";
 		
 		std::size_t length = program.processed ? program.tokens.size() : program.source.size();
-		for(std::size_t i = 0; i < length; i++)
+		for(std::size_t i = 0; i < length; i++) {
 			std::cout << program[i] << (program.processed ? program.tokens[i].data : static_cast<char>(0));
+
+			//Cell the token works on, if it isn't the current one
+			if(program.processed && program.tokens[i].offset != 0)
+				std::cout << '@' << program.tokens[i].offset;
+		}
 		std::cout << std::endl;
 	} 
 	if(comflags.dump)
@@ -228,10 +272,19 @@ void evalLoop(std::shared_ptr<bs::Interpreter> interpreter, std::stringbuf &buff
 		std::cerr << "unused" << std::endl;
 	}
 
+	//--raw input would read the commands too
+	if(options.flags[16])
+		std::cerr << "Warning: --raw unused" << std::endl;
+
+	interpreter->setEOFPolicy(options.eof);
+
 
 	while(true) {
 		std::cout << ": "; //This symbol is arbitrary I just needed something thats not a brainf*** instruction
-		std::getline(std::cin, input);
+
+		//The input ended, so there's nothing more to run
+		if(!std::getline(std::cin, input))
+			return;
 
 		//Command stuff, if it's not a command run it in the interpreter
 		if(parseCommand(input) || input == "") {
@@ -290,7 +343,19 @@ int main(int argc, char *argv[]) {
 		<< " -md          Display a dump of the entire memory after execution\n"
 		<< " -mp          Display the current cell and a few around it after execution\n"
 	#if defined(USE_JIT)
-		<< " -j           Use the x86_64 JIT recompiler instead of the basic interpreter"
+		<< " -j           Use the x86_64 JIT recompiler instead of the basic interpreter\n"
+	#endif
+		<< " -t           Use the threaded interpreter instead of the basic interpreter\n"
+		<< " --passes     Display the time and token count of each optimization pass\n"
+		<< " --unbuffered Write output right away instead of holding it in a buffer\n"
+		<< " --grow       Start in the middle of a tape that grows in both directions, instead of 30000 cells\n"
+		<< " --sparse     Like --grow, but the tape is kept in separate pages, for programs that use cells far apart,\n"
+		<< "              it can't be used with -j or --aot\n"
+		<< " --raw        Read input as raw bytes, newlines included, instead of a line at a time\n"
+		<< " --eof=VALUE  What input sets a cell to after it ends, 0, -1 or same, which is the default\n"
+		<< " --cache=DIR  Keep optimized and compiled programs in DIR, and reuse them when the source is the same\n"
+	#if defined(USE_AOT)
+		<< " --aot=FILE   Compile the program into a static executable at FILE instead of running it"
 	#endif
 		<< std::endl;
 
@@ -310,30 +375,44 @@ int main(int argc, char *argv[]) {
 		std::ostream stream(nullptr);
 		stream.rdbuf(&buffer);
 		std::shared_ptr<bs::Interpreter> interpreter;
+		bs::TAPE_KIND tape = options.flags[15] ? bs::TAPE_SPARSE : options.flags[14] ? bs::TAPE_GROWABLE : bs::TAPE_FIXED;
 		
 	#if defined(USE_JIT)
 		if(options.flags[10]) {
-			interpreter = std::make_shared<bs::jit::JITInterpreter>(stream, options.flags[8]);
+			interpreter = std::make_shared<bs::jit::JITInterpreter>(stream, options.flags[8], 30000, tape);
+		} else if(options.flags[11]) {
+			interpreter = std::make_shared<bs::ThreadedInterpreter>(stream, options.flags[8], 30000, tape);
 		} else {
-			interpreter = std::make_shared<bs::BasicInterpreter>(stream, options.flags[8]);
+			interpreter = std::make_shared<bs::BasicInterpreter>(stream, options.flags[8], 30000, tape);
 		}
 	#else
-		interpreter = std::make_shared<bs::BasicInterpreter>(stream, options.flags[8]);
+		if(options.flags[11]) {
+			interpreter = std::make_shared<bs::ThreadedInterpreter>(stream, options.flags[8], 30000, tape);
+		} else {
+			interpreter = std::make_shared<bs::BasicInterpreter>(stream, options.flags[8], 30000, tape);
+		}
 	#endif
 
 		evalLoop(interpreter, buffer);
 		return 0;
 	} else {
 		std::shared_ptr<bs::Interpreter> interpreter;
+		bs::TAPE_KIND tape = options.flags[15] ? bs::TAPE_SPARSE : options.flags[14] ? bs::TAPE_GROWABLE : bs::TAPE_FIXED;
 
 		#if defined(USE_JIT)
-		if(options.flags[10]) {
-			interpreter = std::make_shared<bs::jit::JITInterpreter>(std::cout, options.flags[8]);
+		if(options.flags[10] || !options.aotPath.empty()) {
+			interpreter = std::make_shared<bs::jit::JITInterpreter>(std::cout, options.flags[8], 30000, tape);
+		} else if(options.flags[11]) {
+			interpreter = std::make_shared<bs::ThreadedInterpreter>(std::cout, options.flags[8], 30000, tape);
 		} else {
-			interpreter = std::make_shared<bs::BasicInterpreter>(std::cout, options.flags[8]);
+			interpreter = std::make_shared<bs::BasicInterpreter>(std::cout, options.flags[8], 30000, tape);
 		}
 	#else
-		interpreter = std::make_shared<bs::BasicInterpreter>(std::cout, options.flags[8]);
+		if(options.flags[11]) {
+			interpreter = std::make_shared<bs::ThreadedInterpreter>(std::cout, options.flags[8], 30000, tape);
+		} else {
+			interpreter = std::make_shared<bs::BasicInterpreter>(std::cout, options.flags[8], 30000, tape);
+		}
 	#endif
 
 		std::ifstream file(options.path);
@@ -364,11 +443,52 @@ int main(int argc, char *argv[]) {
 		unsigned int optLevel = options.flags[4] ? 2 : options.flags[3] ? 1 : 0;
 		std::chrono::microseconds delta;
 		
+		//--norun nothing should run, not even ahead of time, and neither should --aot since the executable starts from the beginning
+		if(options.flags[9] || !options.aotPath.empty())
+			interpreter->setPreRunBudget(0);
+
+		if(options.flags[13])
+			interpreter->setOutputBufferSize(0);
+
+		interpreter->setCacheDir(options.cacheDir);
+		interpreter->setRawInput(options.flags[16]);
+		interpreter->setEOFPolicy(options.eof);
+
+	#if defined(USE_MMAP)
+		//The program's output goes straight to standard output, skipping the copy through std::cout
+		std::cout.flush();
+		interpreter->setOutputFile(1);
+	#endif
+
 		//-p should the program be preprocessed
 		if(!interpreter->loadProgram(buffer.str().c_str(), options.flags[2], true, optLevel)) {
 			std::cerr << "Error :" << interpreter->getError() << std::endl;
 			return 4;
-		} else if(!options.flags[9]) {
+		}
+
+	#if defined(USE_AOT)
+		//--aot write the compiled program out instead of running it
+		if(!options.aotPath.empty()) {
+			auto compiled = std::static_pointer_cast<bs::jit::JITInterpreter>(interpreter);
+
+			if(!compiled->writeExecutable(options.aotPath)) {
+				std::cerr << "Error :" << compiled->getError() << std::endl;
+				return 4;
+			}
+
+			return 0;
+		}
+	#endif
+
+		//--passes print the stats from optimizing
+		if(options.flags[12]) {
+			for(const bs::PassStats &stats : interpreter->getPassStats()) {
+				std::cerr << stats.name << ": " << stats.millis << "ms, "
+					  << stats.tokensBefore << " -> " << stats.tokensAfter << " tokens" << std::endl;
+			}
+		}
+
+		if(!options.flags[9]) {
 			//Timing start
 			auto start = std::chrono::steady_clock::now();
 
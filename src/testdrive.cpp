@@ -22,19 +22,22 @@ int main() {
     #endif
 
     //Truth Machine
+    bs::jit::Label loop = emitter.newLabel();
+    bs::jit::Label end = emitter.newLabel();
+
     emitter.push_reg(bs::jit::r14);
     emitter.push_reg(bs::jit::r10);
     emitter.movabs((uint64_t)my_print, bs::jit::r10);
     emitter.mov(arg, bs::jit::r14);
     emitter.cmpb_at_reg(1, bs::jit::r14);
-    emitter.jnz("end");
-    emitter.emitLabel("loop");
+    emitter.jnz(end);
+    emitter.bind(loop);
     emitter.mov(1, arg);
     emitter.call_at_reg(bs::jit::r10);
     emitter.movabs((uint64_t)my_print, bs::jit::r10);
     emitter.cmpb_at_reg(1, bs::jit::r14);
-    emitter.jz("loop");
-    emitter.emitLabel("end");
+    emitter.jz(loop);
+    emitter.bind(end);
     emitter.mov(0, arg);
     emitter.call_at_reg(bs::jit::r10);
     emitter.pop_reg(bs::jit::r10);
@@ -46,9 +49,7 @@ int main() {
         exit(-1);
     }
 
-    runtime.loadCode(emitter.getCode());
-
-    Func func = reinterpret_cast<Func>(runtime.getMemory());
+    Func func = reinterpret_cast<Func>(runtime.loadCode(emitter.getCode(), emitter.size()));
 
     uint8_t byte = 1;
     std::cin >> byte;
@@ -1,9 +1,12 @@
 #include "jit/Emitter.hpp"
 
 #include <cstdio>
+#include <cstdlib>
 
 int main() {
     bs::jit::x86_64Emitter emitter;
+    bs::jit::Label yeet_1 = emitter.newLabel();
+    bs::jit::Label yeet_2 = emitter.newLabel();
     emitter.push_reg(bs::jit::r8);
     emitter.push_reg(bs::jit::rsi);
     emitter.movabs(255, bs::jit::r10);
@@ -21,7 +24,7 @@ int main() {
     emitter.sub_from_reg(2, bs::jit::rbp);
     emitter.subb_at_reg(2, bs::jit::r10);
     emitter.subb_at_reg(2, bs::jit::rbp);
-    emitter.emitLabel("yeet_2");
+    emitter.bind(yeet_2);
     emitter.inc(bs::jit::r13);
     emitter.inc(bs::jit::rcx);
     emitter.dec(bs::jit::r14);
@@ -30,11 +33,11 @@ int main() {
     emitter.call_at_reg(bs::jit::r12);
     emitter.cmpb_at_reg(5, bs::jit::rcx);
     emitter.cmpb_at_reg(0, bs::jit::r15);
-    emitter.jnz("yeet_1");
-    emitter.jz("yeet_2");
+    emitter.jnz(yeet_1);
+    emitter.jz(yeet_2);
     emitter.pop_reg(bs::jit::r8);
     emitter.pop_reg(bs::jit::rsi);
-    emitter.emitLabel("yeet_1");
+    emitter.bind(yeet_1);
     emitter.ret();
 
     if(!emitter.resolveLabels()) {
@@ -42,10 +45,8 @@ int main() {
         std::exit(-1);
     }
 
-    std::vector<uint8_t> code = emitter.getCode();
-
-    for(uint8_t byte : code) {
-        std::printf("\\x%0.2X", byte);
+    for(std::size_t i = 0; i < emitter.size(); i++) {
+        std::printf("\\x%0.2X", emitter.getCode()[i]);
     }
 
     std::printf("\n");
@@ -0,0 +1,341 @@
+/*
+ * Copyright (c) 2019 Spencer Burton
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "lest.hpp"
+#include "Memory.hpp"
+#include "jit/Emitter.hpp"
+
+//Writes text to a new temporary file and returns its path
+std::string writeTemp(const std::string& text) {
+	char path[] = "/tmp/bstestXXXXXX";
+	int fd = mkstemp(path);
+	if(fd < 0) {
+		return "";
+	}
+	if(write(fd, text.data(), text.size()) != (ssize_t)text.size()) {
+		close(fd);
+		return "";
+	}
+	close(fd);
+	return path;
+}
+
+//Runs the command with the input file as standard input, and returns what it printed
+std::string runCommand(const std::string& command, const std::string& input) {
+	std::string inputPath = writeTemp(input);
+	std::string output;
+
+	if(FILE* pipe = popen((command + " < " + inputPath + " 2>&1").c_str(), "r")) {
+		char buffer[4096];
+		size_t read;
+		while((read = fread(buffer, 1, sizeof(buffer), pipe)) > 0) {
+			output.append(buffer, read);
+		}
+		pclose(pipe);
+	}
+
+	unlink(inputPath.c_str());
+	return output;
+}
+
+//Runs bsi with the options on the program and input, and returns what it printed
+std::string run(const std::string& options, const std::string& program, const std::string& input = "") {
+	std::string programPath = writeTemp(program);
+	std::string output = runCommand(std::string(BSI) + " " + options + " " + programPath, input);
+
+	unlink(programPath.c_str());
+	return output;
+}
+
+//Runs bsi's interactive mode with the options, the input being the lines typed into it
+std::string runInteractive(const std::string& options, const std::string& input) {
+	return runCommand(std::string(BSI) + " " + options, input);
+}
+
+//Compiles the program into an executable with --aot and runs that instead
+std::string runExecutable(const std::string& program, const std::string& input = "") {
+	std::string path = writeTemp("");
+	std::string output = run("--aot=" + path, program);
+
+	if(output.empty()) {
+		output = runCommand(path, input);
+	}
+
+	unlink(path.c_str());
+	return output;
+}
+
+//Sets count cells to one going right, leaving the pointer on the last of them
+std::string ones(std::size_t count) {
+	std::string program;
+	for(std::size_t i = 0; i < count; i++) {
+		program += i == 0 ? "+" : ">+";
+	}
+	return program;
+}
+
+//The /proc/self/pagemap entry of the page an address is in, bit 63 is set when the page is in memory
+uint64_t pageEntry(const void* address) {
+	uint64_t entry = 0;
+	int fd = open("/proc/self/pagemap", O_RDONLY);
+	if(fd >= 0) {
+		if(pread(fd, &entry, sizeof(entry), reinterpret_cast<uintptr_t>(address) / sysconf(_SC_PAGESIZE) * sizeof(entry)) != sizeof(entry)) {
+			entry = 0;
+		}
+		close(fd);
+	}
+	return entry;
+}
+
+//Reads the whole file at path
+std::string readFile(const std::string& path) {
+	std::ifstream stream(path, std::ios::binary);
+	return std::string((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+}
+
+//Every way of running a program that should print the same thing
+const char* const modes[] = {"", "-p -O2", "-t", "-t -p -O2", "-j", "-j -p -O2"};
+
+const lest::test specification[] = {
+	CASE("Every mode prints the same output for a simple program") {
+		for(const char* mode : modes) {
+			EXPECT(run(mode, std::string(8, '+') + "[>" + std::string(8, '+') + "<-]>+.") == "A");
+		}
+	},
+
+	CASE("Input at the end keeps the stores before it") {
+		std::string program = ",[-]" + std::string(65, '+') + ".,.";
+		for(const char* mode : modes) {
+			EXPECT(run(std::string(mode) + " --raw", program, "x") == "AA");
+		}
+	},
+
+	CASE("Output before an out-of-bounds access is printed") {
+		for(const char* mode : modes) {
+			EXPECT(run(mode, "++.<+").substr(0, 1) == "\x02");
+		}
+		EXPECT(runExecutable("++.<+").substr(0, 1) == "\x02");
+	},
+
+	CASE("The threaded interpreter prints the same as the basic one when an output goes off the tape") {
+		const char* const programs[] = {"<.", "++.<.", "+[<.]", "-[>.+]"};
+		for(const char* program : programs) {
+			for(const char* options : {"", "-p -O1", "-p -O2"}) {
+				std::string basic = run(options, program);
+				EXPECT(basic.find(std::string(1, '\0') + "Error: Out-of-Bounds") != std::string::npos);
+				EXPECT(run(std::string("-t ") + options, program) == basic);
+			}
+		}
+	},
+
+	CASE("Each line in interactive mode starts on the cell the last one finished on") {
+		for(const char* mode : modes) {
+			EXPECT(runInteractive(mode, "++>+++\n<.\n") == ": : \x02\n: ");
+		}
+	},
+
+	CASE("Unprocessed programs only fail on an unmatched bracket once it's reached") {
+		for(const char* mode : {"", "-t"}) {
+			EXPECT(run(mode, "+[.") == "\x01");
+			EXPECT(run(mode, "+.]") == "\x01" "Error: No matching bracket [ for instruction ']' at character 3\n");
+			EXPECT(run(mode, "[").find("No matching bracket ] for instruction '[' at character 1") != std::string::npos);
+		}
+	},
+
+	CASE("Printed constants can start past the largest offset an instruction holds") {
+		std::size_t count = (1 << 23) + 1;
+		std::string program = std::string(65, '+') + std::string(count, '.') + ",[-]" + std::string(66, '+') + ".";
+		for(const char* mode : modes) {
+			EXPECT(run(mode, program, "x") == std::string(count, 'A') + "B");
+		}
+		EXPECT(runExecutable(program, "x") == std::string(count, 'A') + "B");
+	},
+
+	CASE("The JIT refuses a sparse tape before running anything") {
+		EXPECT(run("-j --sparse", "+.").rfind("Error: --sparse can't be used", 0) == 0u);
+		EXPECT(run("--sparse", "+.") == "\x01");
+	},
+
+	CASE("Going off either end of the tape is an error") {
+		const std::string programs[] = {"<+", "+[<+]", "+[>+]", "+[>>>+]", "+>+[<]", "+[[>]+]", std::string(30000, '>') + "+", std::string(29999, '>') + "+[-]+>[-]"};
+		for(const std::string& program : programs) {
+			for(const char* mode : modes) {
+				EXPECT(run(mode, program).find("Out-of-Bounds") != std::string::npos);
+			}
+			EXPECT(runExecutable(program).find("Out-of-Bounds") != std::string::npos);
+		}
+	},
+
+	CASE("Nothing is printed before going off the tape with a cell that's only set") {
+		const std::string programs[] = {"<[-].", "<,.", std::string(30000, '>') + "[-]."};
+		for(const std::string& program : programs) {
+			for(const char* mode : {"", "-t", "-t -p -O1", "-j", "-j -p -O1", "-j -p -O2"}) {
+				EXPECT(run(mode, program, "x").rfind("Error: Out-of-Bounds", 0) == 0u);
+			}
+			EXPECT(runExecutable(program, "x").rfind("Error: Out-of-Bounds", 0) == 0u);
+		}
+	},
+
+	CASE("Multiplies from a zero cell don't touch the cells they would add to") {
+		std::string program = ">[-" + std::string(100, '<') + "+" + std::string(100, '>') + "]+.";
+		for(const char* mode : modes) {
+			EXPECT(run(mode, program) == "\x01");
+		}
+		EXPECT(runExecutable(program) == "\x01");
+	},
+
+	CASE("Scans stop at the zero cells next to the ends of the tape") {
+		const std::string programs[] = {">+>+>+[<]>.", std::string(29999, '>') + "<+<+[>]+.", std::string(29970, '>') + ones(28) + "[<]>[>]+."};
+		for(const std::string& program : programs) {
+			for(const char* mode : modes) {
+				EXPECT(run(mode, program) == "\x01");
+			}
+			EXPECT(runExecutable(program) == "\x01");
+		}
+	},
+
+	CASE("A damaged program cache file is optimized again instead of run") {
+		//Sets the cell to 'A' and prints it as a constant, so the tokens start with a SET and a PRINT of one byte
+		std::string program = std::string(8, '+') + "[>" + std::string(8, '+') + "<-]>+.,.[>+<-]>.";
+		std::size_t header = 56, token = 12;
+		struct Damage { std::size_t at; int32_t value; std::size_t size; } damages[] = {
+			{header, 'Q', 1}, //Not an instruction
+			{header, ']', 1}, //Bracket with nothing open
+			{header + token + 8, 1000, 4}, //Print starting past the constants
+		};
+
+		for(const char* mode : {"-p -O2", "-t -p -O2"}) {
+			char directory[] = "/tmp/bstestXXXXXX";
+			EXPECT(mkdtemp(directory) != nullptr);
+			std::string options = std::string(mode) + " --cache=" + directory;
+
+			EXPECT(run(options, program, "b") == "Abb");
+
+			std::string file = std::filesystem::directory_iterator(directory)->path().string();
+			std::string good = readFile(file);
+
+			for(const Damage& damage : damages) {
+				std::string bad = good;
+				std::memcpy(&bad[damage.at], &damage.value, damage.size);
+				std::ofstream(file, std::ios::binary) << bad;
+
+				EXPECT(run(options, program, "b") == "Abb");
+				EXPECT(readFile(file) != bad);
+			}
+
+			std::filesystem::remove_all(directory);
+		}
+	},
+
+	CASE("Compiled code from a damaged cache file is compiled again instead of run") {
+		std::string program = std::string(8, '+') + "[>" + std::string(8, '+') + "<-]>+.,.[>+<-]>.";
+		std::size_t header = 120;
+
+		for(const char* mode : {"-j", "-j -p -O2"}) {
+			char directory[] = "/tmp/bstestXXXXXX";
+			EXPECT(mkdtemp(directory) != nullptr);
+			std::string options = std::string(mode) + " --cache=" + directory;
+
+			EXPECT(run(options, program, "b") == "Abb");
+
+			std::string file;
+			for(const auto& entry : std::filesystem::directory_iterator(directory)) {
+				if(entry.path().extension() == ".bsjt") {
+					file = entry.path().string();
+				}
+			}
+			std::string good = readFile(file);
+
+			uint64_t codeSize, relocations, codeMap;
+			std::memcpy(&codeSize, &good[header - 24], 8);
+			std::memcpy(&relocations, &good[header - 16], 8);
+			std::memcpy(&codeMap, &good[header - 8], 8);
+			EXPECT(relocations > 0u);
+			EXPECT(codeMap > 1u);
+
+			std::size_t relocation = header + codeSize, mapping = relocation + relocations * 16;
+			struct Damage { std::size_t at; uint64_t value; std::size_t size; } damages[] = {
+				{relocation + 4, codeSize - 4, 4}, //Address running off the end of the code
+				{relocation + 8, 1 << 20, 8}, //Address past the constants or another base
+				{mapping, codeSize + 1, 8}, //Code map entry after the code
+				{mapping + 16, 0, 8}, //Code map entries out of order
+				{mapping + 8, uint64_t(1) << 40, 8}, //Code map entry for an instruction past the program
+			};
+
+			for(const Damage& damage : damages) {
+				std::string bad = good;
+				std::memcpy(&bad[damage.at], &damage.value, damage.size);
+				std::ofstream(file, std::ios::binary) << bad;
+
+				EXPECT(run(options, program, "b") == "Abb");
+				EXPECT(readFile(file) != bad);
+			}
+
+			std::filesystem::remove_all(directory);
+		}
+	},
+
+	CASE("Restoring a snapshot puts back the cells from when it was taken") {
+		for(bs::TAPE_KIND kind : {bs::TAPE_FIXED, bs::TAPE_GROWABLE, bs::TAPE_SPARSE}) {
+			bs::Tape tape(30000, kind);
+			std::size_t start = tape.m_start;
+
+			EXPECT_NOT(tape.restore());
+
+			tape.cell(start) = 1;
+			tape.cell(start + 5000) = 2;
+			tape.snapshot();
+			tape.cell(start) = 3;
+			tape.cell(start + 10000) = 4;
+
+		#if defined(USE_GUARD_PAGES)
+			//The pages written since are dropped instead of copied back, so they aren't in memory until they're read again
+			if(kind != bs::TAPE_SPARSE) {
+				EXPECT((pageEntry(tape.m_cells + start + 10000) >> 63) == 1u);
+				EXPECT(tape.restore());
+				EXPECT((pageEntry(tape.m_cells + start + 10000) >> 63) == 0u);
+			}
+		#endif
+
+			EXPECT(tape.restore());
+			EXPECT(tape.cell(start) == 1);
+			EXPECT(tape.cell(start + 5000) == 2);
+			EXPECT(tape.cell(start + 10000) == 0);
+
+			//The same snapshot can be restored again
+			tape.cell(start + 5000) = 5;
+			EXPECT(tape.restore());
+			EXPECT(tape.cell(start + 5000) == 2);
+		}
+	},
+
+	CASE("mov encodes the registers past rdi") {
+		using namespace bs::jit;
+
+		x86_64Emitter emitter;
+		emitter.mov(rdi, r13);
+		emitter.mov(r8, r14);
+		emitter.mov(rsi, r15);
+
+		const uint8_t expected[] = {0x49, 0x89, 0xFD, 0x4D, 0x89, 0xC6, 0x49, 0x89, 0xF7};
+		EXPECT(emitter.size() == sizeof(expected));
+		EXPECT(std::equal(expected, expected + sizeof(expected), emitter.getCode()));
+	},
+};
+
+int main(int argc, char* argv[]) {
+	return lest::run(specification, argc, argv);
+}
\ No newline at end of file